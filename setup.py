@@ -44,4 +44,4 @@ setup(name             = 'RPi.GPIO',
       url              = 'http://sourceforge.net/projects/raspberry-gpio-python/',
       classifiers      = classifiers,
       packages         = ['RPi'],
-      ext_modules      = [Extension('RPi.GPIO', ['source/py_gpio.c', 'source/c_gpio.c', 'source/cpuinfo.c', 'source/event_gpio.c', 'source/soft_pwm.c', 'source/py_pwm.c', 'source/common.c', 'source/constants.c',  'source/bcm2835.c'])])
+      ext_modules      = [Extension('RPi.GPIO', ['source/py_gpio.c', 'source/c_gpio.c', 'source/cpuinfo.c', 'source/event_gpio.c', 'source/soft_pwm.c', 'source/py_pwm.c', 'source/py_pin.c', 'source/common.c', 'source/constants.c',  'source/bcm2835.c', 'source/dma_ir.c', 'source/ir_capture.c', 'source/waveform.c', 'source/realtime.c', 'source/trace.c', 'source/pwm_ramp.c'])])
@@ -33,6 +33,7 @@ volatile uint32_t *bcm2835_spi0 = MAP_FAILED;
 volatile uint32_t *bcm2835_bsc0 = MAP_FAILED;
 volatile uint32_t *bcm2835_bsc1 = MAP_FAILED;
 volatile uint32_t *bcm2835_st	= MAP_FAILED;
+volatile uint32_t *bcm2835_dma  = MAP_FAILED;
 
 
 // This variable allows us to test on hardware other than RPi.
@@ -399,6 +400,13 @@ void bcm2835_gpio_write_mask(uint32_t value, uint32_t mask)
     bcm2835_gpio_clr_multi((~value) & mask);
 }
 
+// Read the levels of all pins, levels[0] from GPLEV0 and levels[1] from GPLEV1
+void bcm2835_gpio_lev_multi(uint32_t *levels)
+{
+    levels[0] = bcm2835_peri_read(bcm2835_gpio + BCM2835_GPLEV0/4);
+    levels[1] = bcm2835_peri_read_nb(bcm2835_gpio + BCM2835_GPLEV1/4);
+}
+
 // Set the pullup/down resistor for a pin
 //
 // The GPIO Pull-up/down Clock Registers control the actuation of internal pull-downs on
@@ -1008,6 +1016,7 @@ int bcm2835_init(void)
 	bcm2835_bsc0 = (uint32_t*)BCM2835_BSC0_BASE;
 	bcm2835_bsc1 = (uint32_t*)BCM2835_BSC1_BASE;
 	bcm2835_st   = (uint32_t*)BCM2835_ST_BASE;
+	bcm2835_dma  = (uint32_t*)BCM2835_DMA_BASE;
 	return 1; // Success
     }
     int memfd = -1;
@@ -1023,45 +1032,36 @@ int bcm2835_init(void)
     // GPIO:
     bcm2835_gpio = mapmem("gpio", BCM2835_BLOCK_SIZE, memfd, BCM2835_GPIO_BASE);
     if (bcm2835_gpio == MAP_FAILED) goto exit;
-    printf("GPIO mapped.\n");
     // PWM
     bcm2835_pwm = mapmem("pwm", BCM2835_BLOCK_SIZE, memfd, BCM2835_GPIO_PWM);
     if (bcm2835_pwm == MAP_FAILED) goto exit;
-    printf("pwm mapped.\n");
     // Clock control (needed for PWM)
     bcm2835_clk = mapmem("clk", BCM2835_BLOCK_SIZE, memfd, BCM2835_CLOCK_BASE);
     if (bcm2835_clk == MAP_FAILED) goto exit;
-    printf("clk mapped.\n");   
     bcm2835_pads = mapmem("pads", BCM2835_BLOCK_SIZE, memfd, BCM2835_GPIO_PADS);
     if (bcm2835_pads == MAP_FAILED) goto exit;
-    printf("pads mapped.\n");
     bcm2835_spi0 = mapmem("spi0", BCM2835_BLOCK_SIZE, memfd, BCM2835_SPI0_BASE);
     if (bcm2835_spi0 == MAP_FAILED) goto exit;
-    printf("spi0 mapped.\n");
     // I2C
     bcm2835_bsc0 = mapmem("bsc0", BCM2835_BLOCK_SIZE, memfd, BCM2835_BSC0_BASE);
     if (bcm2835_bsc0 == MAP_FAILED) goto exit;
-    printf("bsc0 mapped.\n");
     bcm2835_bsc1 = mapmem("bsc1", BCM2835_BLOCK_SIZE, memfd, BCM2835_BSC1_BASE);
     if (bcm2835_bsc1 == MAP_FAILED) goto exit;
-    printf("bsc1 mapped.\n");
     // ST
     bcm2835_st = mapmem("st", BCM2835_BLOCK_SIZE, memfd, BCM2835_ST_BASE);
     if (bcm2835_st == MAP_FAILED) goto exit;
-    printf("st mapped.\n");
+    // DMA (PWM FIFO is in the pwm block)
+    bcm2835_dma = mapmem("dma", BCM2835_BLOCK_SIZE, memfd, BCM2835_DMA_BASE);
+    if (bcm2835_dma == MAP_FAILED) goto exit;
     ok = 1;
 
 exit:
     if (memfd >= 0)
         close(memfd);
 
-    if (!ok) {
+    if (!ok)
         bcm2835_close();
-        printf("Init not OK bcm2835_close.\n");
-    } else {
-        printf("Init OK bcm2835 ready.\n");
-    };
-    
+
     return ok;
 }
 
@@ -1077,6 +1077,7 @@ int bcm2835_close(void)
     unmapmem((void**) &bcm2835_bsc1, BCM2835_BLOCK_SIZE);
     unmapmem((void**) &bcm2835_st,   BCM2835_BLOCK_SIZE);
     unmapmem((void**) &bcm2835_pads, BCM2835_BLOCK_SIZE);
+    unmapmem((void**) &bcm2835_dma,  BCM2835_BLOCK_SIZE);
     return 1; // Success
 }    
 
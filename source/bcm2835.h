@@ -309,6 +309,8 @@
 #define BCM2835_PERI_BASE               0x20000000
 /// Base Physical Address of the System Timer registers
 #define BCM2835_ST_BASE			(BCM2835_PERI_BASE + 0x3000)
+/// Base Physical Address of the DMA controller registers (channels 0 to 14)
+#define BCM2835_DMA_BASE		(BCM2835_PERI_BASE + 0x7000)
 /// Base Physical Address of the Pads registers
 #define BCM2835_GPIO_PADS               (BCM2835_PERI_BASE + 0x100000)
 /// Base Physical Address of the Clock/timer registers
@@ -357,6 +359,13 @@ extern volatile uint32_t *bcm2835_bsc0;
 /// Available after bcm2835_init has been called
 extern volatile uint32_t *bcm2835_bsc1;
 
+/// Base of the DMA registers.
+/// Available after bcm2835_init has been called
+extern volatile uint32_t *bcm2835_dma;
+
+/// Bus address of the peripheral registers, as seen by the DMA controller
+#define BCM2835_PERI_BUS_BASE           0x7E000000
+
 /// Size of memory page on RPi
 #define BCM2835_PAGE_SIZE               (4*1024)
 /// Size of memory block on RPi
@@ -682,6 +691,8 @@ typedef enum
 #define BCM2835_PWM1_RANGE  8
 #define BCM2835_PWM1_DATA   9
 
+#define BCM2835_PWM_DMAC_ENAB   0x80000000  ///< DMA Enable
+
 // Defines for PWM Clock, word offsets (ie 4 byte multiples)
 #define BCM2835_PWMCLK_CNTL     40
 #define BCM2835_PWMCLK_DIV      41
@@ -1010,6 +1021,10 @@ extern "C" {
     /// \param[in] mask Mask of pins to affect. Use eg: (1 << RPI_GPIO_P1_03) | (1 << RPI_GPIO_P1_05)
     extern void bcm2835_gpio_write_mask(uint32_t value, uint32_t mask);
 
+    /// Reads the levels of all GPIO pins with one read of each level register
+    /// \param[out] levels levels[0] receives GPLEV0 (pins 0 to 31), levels[1] GPLEV1 (pins 32 to 53)
+    extern void bcm2835_gpio_lev_multi(uint32_t *levels);
+
     /// Sets the Pull-up/down mode for the specified pin. This is more convenient than
     /// clocking the mode in with bcm2835_gpio_pud() and bcm2835_gpio_pudclk().
     /// \param[in] pin GPIO number, or one of RPI_GPIO_P1_* from \ref RPiGPIOPin.
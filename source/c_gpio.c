@@ -29,6 +29,8 @@ SOFTWARE.
 
 #include "c_gpio.h"
 #include "bcm2835.h"
+#include "realtime.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -89,14 +91,55 @@ int setup(void)
     return SETUP_OK;
 }
 
+// Use map as the GPIO register page instead of /dev/mem, to run on a simulated page
+void setup_map(volatile uint32_t *map)
+{
+    gpio_map = map;
+}
+
 void clear_event_detect(int gpio)
 {
 	int offset = EVENT_DETECT_OFFSET + (gpio/32);
     int shift = (gpio%32);
 
-    *(gpio_map+offset) |= (1 << shift);
-    short_wait();
-    *(gpio_map+offset) = 0;
+    // GPEDS bits clear when written with 1, the other gpios keep their events
+    *(gpio_map+offset) = (1 << shift);
+}
+
+// Edges latched for all gpios, GPEDS1 in the high word
+uint64_t event_mask(void)
+{
+    uint32_t low = *(gpio_map+EVENT_DETECT_OFFSET);
+    return ((uint64_t)*(gpio_map+EVENT_DETECT_OFFSET+1) << 32) | low;
+}
+
+// Clear the edges of mask, a single write per register
+void clear_event_mask(uint64_t mask)
+{
+    if ((uint32_t)mask)
+        *(gpio_map+EVENT_DETECT_OFFSET) = (uint32_t)mask;
+    if (mask >> 32)
+        *(gpio_map+EVENT_DETECT_OFFSET+1) = (uint32_t)(mask >> 32);
+}
+
+// Set the outputs of set and clear those of clr, a single write per register
+void output_gpio_mask(uint64_t set, uint64_t clr)
+{
+    if ((uint32_t)set)
+        *(gpio_map+SET_OFFSET) = (uint32_t)set;
+    if (set >> 32)
+        *(gpio_map+SET_OFFSET+1) = (uint32_t)(set >> 32);
+    if ((uint32_t)clr)
+        *(gpio_map+CLR_OFFSET) = (uint32_t)clr;
+    if (clr >> 32)
+        *(gpio_map+CLR_OFFSET+1) = (uint32_t)(clr >> 32);
+}
+
+// Levels of all gpios, GPLEV1 in the high word
+uint64_t level_mask(void)
+{
+    uint32_t low = *(gpio_map+PINLEVEL_OFFSET);
+    return ((uint64_t)*(gpio_map+PINLEVEL_OFFSET+1) << 32) | low;
 }
 
 int eventdetected(int gpio)
@@ -133,7 +176,6 @@ void set_falling_event(int gpio, int enable)
 	if (enable)
 	{
 	    *(gpio_map+offset) |= (1 << shift);
-	    *(gpio_map+offset) = (1 << shift);
 	} else {
 	    *(gpio_map+offset) &= ~(1 << shift);
 	}
@@ -222,6 +264,15 @@ void output_gpio(int gpio, int value)
     *(gpio_map+offset) = 1 << shift;
 }
 
+void pin_init(GpioPin *pin, int gpio)
+{
+    pin->gpio = gpio;
+    pin->set = gpio_map + SET_OFFSET + (gpio/32);
+    pin->clr = gpio_map + CLR_OFFSET + (gpio/32);
+    pin->lev = gpio_map + PINLEVEL_OFFSET + (gpio/32);
+    pin->mask = 1 << (gpio%32);
+}
+
 int input_gpio(int gpio)
 {
    int offset, value, mask;
@@ -242,14 +293,12 @@ int init_bcm2835(void)
 {   
     if (!BMC2835_IsInit) {
         if (!bcm2835_init()) {
-            printf("bcm2835_init fail\n");
+            TRACE(TRACE_BCM2835_INIT, 0);
             BMC2835_IsInit = 0;
             return 0;
         }
-        printf("bcm2835_init OK\n");
+        TRACE(TRACE_BCM2835_INIT, 1);
         BMC2835_IsInit = 1;
-    } else {
-        printf("BCM2835 already init.");
     }
     return 1;
 }
@@ -260,22 +309,41 @@ void close_bcm2835(void)
         bcm2835_close();
 }
 
+// PWM2835 objects using each PWM channel, a carrier leaves them and the clock they run on alone
+static int pwm_users[2] = { 0, 0 };
+static unsigned int pwm_divider = 0;   // clock divider in use, set by pwm_setdivider() only
+
 void init_pwm(int gpio, int pwm_channel, int divider, int range)
 {
+    pwm_users[pwm_channel]++;
       // Set the output pin to Alt Fun 5, to allow PWM channel 0 to be output there
     bcm2835_gpio_fsel(gpio, BCM2835_GPIO_FSEL_ALT5);
     // Clock divider is set to 16.
     // With a divider of 16 and a RANGE of 1024, in MARKSPACE mode,
     // the pulse repetition frequency will be
     // 1.2MHz/1024 = 1171.875Hz, suitable for driving a DC motor with PWM  -  BCM2835_PWM_CLOCK_DIVIDER_16
-    bcm2835_pwm_set_clock(divider);
+    pwm_setdivider(divider);
     bcm2835_pwm_set_mode(pwm_channel, 1, 1);
     bcm2835_pwm_set_range(pwm_channel, range);
 }
 
+// The PWM2835 on pwm_channel is gone
+void release_pwm(int pwm_channel)
+{
+    if (pwm_users[pwm_channel] > 0)
+        pwm_users[pwm_channel]--;
+}
+
+// Return 1 when no PWM2835 uses pwm_channel and the clock can be set to divider without
+// changing the one of a PWM2835 on the other channel
+int pwm_channel_free(int pwm_channel, unsigned int divider)
+{
+    return !pwm_users[pwm_channel] && (!pwm_users[!pwm_channel] || pwm_divider == (divider & 0xfff));
+}
+
 int pwm_setclock(unsigned int divider)
 {
-    bcm2835_pwm_set_clock(divider);
+    pwm_setdivider(divider);
     return 0;
 }
 
@@ -291,61 +359,237 @@ int pwm_setlevel(unsigned int pwm_channel, unsigned int range)
     return 0;
 }
 
-// Hardware pwm on gpio pin with BCM2538 lib
-int pwm_pulsepause(int pwm_channel, long tpulse, long tpause, int range, PulsePair *pair)
+// Wait until the system timer reaches deadline (absolute, in us) and return the time read.
+// Long waits sleep first, the end is busy-waited for accuracy.
+uint64_t wait_deadline(uint64_t deadline)
 {
-    struct timeval tStart, tPulse, tPause;
-    
-    gettimeofday (&tStart, NULL);
-    bcm2835_pwm_set_data(pwm_channel, range);
-    bcm2835_delayMicroseconds((uint64_t)tpulse);
-    
-    gettimeofday (&tPulse, NULL);
-    pair->pulse = delta_time_in_microseconds(&tPulse, &tStart);
-    bcm2835_pwm_set_data(pwm_channel, 0);
-    bcm2835_delayMicroseconds((uint64_t)tpause);
-    
-    gettimeofday (&tPause, NULL);
-    pair->pause = delta_time_in_microseconds(&tPause, &tPulse);
+    struct timespec t1;
+    uint64_t now = bcm2835_st_read();
+
+    if (now + PULSEPAIR_SLEEPTHRESHOLD < deadline)
+    {
+        t1.tv_sec = (time_t)((deadline - now - PULSEPAIR_SLEEPMARGIN) / 1000000);
+        t1.tv_nsec = (long)((deadline - now - PULSEPAIR_SLEEPMARGIN) % 1000000) * 1000;
+        nanosleep(&t1, NULL);
+    }
+    while ((now = bcm2835_st_read()) < deadline)
+        ;
+    return now;
+}
+
+// Drive the pin to value for us microseconds of system timer, then to the opposite level.
+// Return -1 when the system timer could not be mapped.
+int pin_pulse(GpioPin *pin, int value, unsigned int us)
+{
+    uint64_t start;
+
+    if (!BMC2835_IsInit && !init_bcm2835())
+        return -1;
+    start = bcm2835_st_read();
+    PIN_WRITE(pin, value);
+    wait_deadline(start + us);
+    PIN_WRITE(pin, !value);
     return 0;
 }
 
-// Software pwm on gpio pin with BCM2538 lib
-int gpio_pulsepause(int gpio, long tpulse, long tpause, PulsePair *pair)
+// Hardware pwm on gpio pin with BCM2538 lib
+// Every edge is scheduled on an absolute system timer deadline computed from the frame start, so
+// errors never accumulate along the frame. report gets for each pair the lateness in us of the
+// pulse edge and of the pause edge. Return the drift in us of the frame end.
+long pwm_sendpulsepairs(int pwm_channel, PulsePairs *pulsepairs, unsigned int data, PulsePairs *report)
 {
-    struct timeval tStart, tPulse, tPause;
-    
-    gettimeofday (&tStart, NULL);
-    while (tpulse > 0) {
+    unsigned int i;
+    uint32_t pulse, pause;
+    uint64_t deadline, now;
+    RtSaved saved;
+
+    TRACE(TRACE_PULSEPAIRS_SEND, pulsepairs->size);
+    realtime_call_enter(&saved);
+    deadline = bcm2835_st_read();
+    for (i = 0; i < pulsepairs->size; i++) {
+        // read the pair first, report may share the pulsepairs buffer
+        pulse = PULSEPAIR_PULSE(pulsepairs, i);
+        pause = PULSEPAIR_PAUSE(pulsepairs, i);
+
+        now = wait_deadline(deadline);
+        bcm2835_pwm_set_data(pwm_channel, data);
+        PULSEPAIR_PULSE(report, i) = (uint32_t)(now - deadline);
+        deadline += pulse;
+
+        now = wait_deadline(deadline);
+        bcm2835_pwm_set_data(pwm_channel, 0);
+        PULSEPAIR_PAUSE(report, i) = (uint32_t)(now - deadline);
+        deadline += pause;
+    }
+    now = wait_deadline(deadline);
+    realtime_leave(&saved);
+    TRACE(TRACE_PULSEPAIRS_SENT, now - deadline);
+    return (long)(now - deadline);
+}
+
+// Return the PWM channel routed on gpio and set alt to the gpio function giving it, -1 if none.
+int pwm_gpio_channel(int gpio, int *alt)
+{
+    switch (gpio)
+    {
+        case 12 : *alt = BCM2835_GPIO_FSEL_ALT0; return 0;
+        case 13 : *alt = BCM2835_GPIO_FSEL_ALT0; return 1;
+        case 18 : *alt = BCM2835_GPIO_FSEL_ALT5; return 0;
+        case 19 : *alt = BCM2835_GPIO_FSEL_ALT5; return 1;
+        case 40 : *alt = BCM2835_GPIO_FSEL_ALT0; return 0;
+        case 41 : *alt = BCM2835_GPIO_FSEL_ALT0; return 1;
+        case 45 : *alt = BCM2835_GPIO_FSEL_ALT0; return 1;
+        default : return -1;
+    }
+}
+
+// Set the PWM clock divider shared by both channels, only when it changes as
+// bcm2835_pwm_set_clock() waits 110 ms. Every clock change goes through here, so the cache
+// always holds the divider in use.
+void pwm_setdivider(unsigned int divider)
+{
+    divider &= 0xfff;   // as written by bcm2835_pwm_set_clock()
+    if (pwm_divider != divider) {
+        bcm2835_pwm_set_clock(divider);
+        pwm_divider = divider;
+    }
+}
+
+// Generate a carrier with the PWM peripheral on gpio, output stays off (data 0) until the caller
+// writes data. fsel gets the gpio function to put back with bcm2835_gpio_fsel() when done.
+// Return the PWM channel, -1 if gpio has no PWM output, PWM_BUSY if a PWM2835 uses the channel
+// or runs the clock at another divider on the other channel.
+int pwm_setcarrier(int gpio, float frequency, float dutycycle, unsigned int *data, int *fsel)
+{
+    int channel, alt;
+    unsigned int range;
+
+    if ((channel = pwm_gpio_channel(gpio, &alt)) == -1)
+        return -1;
+    if (!pwm_channel_free(channel, IR_CARRIER_DIVIDER))
+        return PWM_BUSY;
+    *fsel = (bcm2835_peri_read(bcm2835_gpio + BCM2835_GPFSEL0/4 + gpio/10) >> ((gpio % 10) * 3)) & BCM2835_GPIO_FSEL_MASK;
+    range = (unsigned int)((float)PWM_CLOCK_FREQUENCY / IR_CARRIER_DIVIDER / frequency + 0.5);
+    *data = (unsigned int)((float)range * dutycycle / 100.0 + 0.5);
+
+    bcm2835_gpio_fsel(gpio, alt);
+    pwm_setdivider(IR_CARRIER_DIVIDER);
+    bcm2835_pwm_set_mode(channel, 1, 1);
+    bcm2835_pwm_set_range(channel, range);
+    bcm2835_pwm_set_data(channel, 0);
+    return channel;
+}
+
+// Software transmit on gpio pin with BCM2538 lib
+// On a gpio with a PWM output the carrier is made by the PWM peripheral at frequency / dutycycle
+// and only the pulse/pause gating stays on the CPU, see pwm_sendpulsepairs().
+// Other gpios fall back to a bit-banged carrier, with cycles placed on absolute deadlines and
+// the last one cut at the pulse end instead of rounding the pulse to the period.
+// drift gets the drift in us of the frame end. Return 0, or PWM_BUSY with nothing sent when
+// the PWM channel of gpio or its clock is used by a PWM2835.
+int gpio_sendpulsepairs(int gpio, PulsePairs *pulsepairs, float frequency, float dutycycle, PulsePairs *report, long *drift)
+{
+    unsigned int i, data;
+    int channel, fsel;
+    uint32_t pause, period, high;
+    uint64_t deadline, pulse_end, cycle, now;
+    RtSaved saved;
+
+    if ((channel = pwm_setcarrier(gpio, frequency, dutycycle, &data, &fsel)) == PWM_BUSY)
+        return PWM_BUSY;
+    if (channel != -1) {
+        *drift = pwm_sendpulsepairs(channel, pulsepairs, data, report);
+        bcm2835_gpio_fsel(gpio, fsel);  // the pin is a plain gpio again
+        return 0;
+    }
+
+    period = (uint32_t)(1000000.0 / frequency + 0.5);
+    if (period < 2)
+        period = 2;
+    high = (uint32_t)((float)period * dutycycle / 100.0 + 0.5);
+    if (high == 0)
+        high = 1;
+    TRACE(TRACE_PULSEPAIRS_SEND, pulsepairs->size);
+    realtime_call_enter(&saved);
+    deadline = bcm2835_st_read();
+    for (i = 0; i < pulsepairs->size; i++) {
+        // read the pair first, report may share the pulsepairs buffer
+        pulse_end = deadline + PULSEPAIR_PULSE(pulsepairs, i);
+        pause = PULSEPAIR_PAUSE(pulsepairs, i);
+
+        now = wait_deadline(deadline);
         bcm2835_gpio_write(gpio, 1);
-        bcm2835_delayMicroseconds(13);
+        PULSEPAIR_PULSE(report, i) = (uint32_t)(now - deadline);
+        for (cycle = deadline; cycle < pulse_end; cycle += period) {
+            if (cycle != deadline) {
+                wait_deadline(cycle);
+                bcm2835_gpio_write(gpio, 1);
+            }
+            if (high >= period || cycle + high >= pulse_end)
+                break;
+            wait_deadline(cycle + high);
+            bcm2835_gpio_write(gpio, 0);
+        }
+        deadline = pulse_end;
+
+        now = wait_deadline(deadline);
         bcm2835_gpio_write(gpio, 0);
-        bcm2835_delayMicroseconds(12);
-        tpulse -= 26;
-    }; 
-    gettimeofday (&tPulse, NULL);
-    pair->pulse = delta_time_in_microseconds(&tPulse, &tStart);
-    bcm2835_delayMicroseconds((uint64_t)tpause);
-    
-    gettimeofday (&tPause, NULL);
-    pair->pause = delta_time_in_microseconds(&tPause, &tPulse);
+        PULSEPAIR_PAUSE(report, i) = (uint32_t)(now - deadline);
+        deadline += pause;
+    }
+    now = wait_deadline(deadline);
+    realtime_leave(&saved);
+    TRACE(TRACE_PULSEPAIRS_SENT, now - deadline);
+    *drift = (long)(now - deadline);
+    return 0;
+}
+
+// Allocate the flat pulse/pause buffer for capacity pairs in a single block. Return 0 on success, -1 on memory error.
+int init_pulsepairs(PulsePairs *pulsepairs, unsigned int capacity)
+{
+    if (capacity == 0)
+        capacity = 1;
+    pulsepairs->size = 0;
+    pulsepairs->pairs = malloc(sizeof(uint32_t) * 2 * capacity);
+    if (pulsepairs->pairs == NULL) {
+        pulsepairs->capacity = 0;
+        return -1;
+    }
+    pulsepairs->capacity = capacity;
+    return 0;
+}
+
+// Append a pair, doubling the buffer only when it is full. Return 0 on success, -1 on memory error.
+int add_pulsepair(PulsePairs *pulsepairs, uint32_t pulse, uint32_t pause)
+{
+    if (pulsepairs->size >= pulsepairs->capacity) {
+        unsigned int capacity = pulsepairs->capacity ? pulsepairs->capacity * 2 : PULSEPAIR_DEFAULTCAPACITY;
+        uint32_t *new_pairs = realloc(pulsepairs->pairs, sizeof(uint32_t) * 2 * capacity);
+        if (new_pairs == NULL)
+            return -1;
+        pulsepairs->pairs = new_pairs;
+        pulsepairs->capacity = capacity;
+    }
+    PULSEPAIR_PULSE(pulsepairs, pulsepairs->size) = pulse;
+    PULSEPAIR_PAUSE(pulsepairs, pulsepairs->size) = pause;
+    pulsepairs->size += 1;
     return 0;
 }
 
 // Look on possible pulse/pause pairs received on imput gpio, used BCM2538 lib. Return 0 in not, 1 if potential code
 // Use full CPU capability, call it after an interrupt event on gpio (GPIO.add_event_callback, for example)
-// Don't forget to free the memory pulsepairs tab  after call by using free_plusepairs()
+// pulsepairs must be set up with init_pulsepairs() before, sized for the expected frame so that no
+// allocation happens while timing. Don't forget to free it after call by using free_plusepairs()
 int gpio_watchpulsepairs(int gpio, PulsePairs *pulsepairs)
 {   
     int value = 0, vread = 0;
-    int size = 0, finish = 0;
+    int finish = 0;
     long pulse = 0, pause =0, tStage = 0;
     struct timeval tStart, tPulse;
+    RtSaved saved;
     
-//    Allocate memory for pulsepairs tab pointeur result
-    pulsepairs->pairs = malloc(sizeof(int *) * 1);
-    pulsepairs->size = 1;
-    pulsepairs->pairs[0] = malloc(sizeof(long *) * 2);
+    pulsepairs->size = 0;
+    realtime_call_enter(&saved);
     gettimeofday (&tStart, NULL);
     while (!finish) {    //
         tStage = 0;
@@ -363,57 +607,40 @@ int gpio_watchpulsepairs(int gpio, PulsePairs *pulsepairs)
         } else {
             if (pulse) { // check if a pluse is set
                 pause = tStage;
-                if (size != 0) { 
-                    int **new_pairs = realloc(pulsepairs->pairs, sizeof(int *) * (size +1));
-                    if (new_pairs != NULL) {
-                        pulsepairs->pairs = new_pairs;
-                        pulsepairs->size = size + 1;
-                        pulsepairs->pairs[size] = malloc(sizeof(long *) * 2);
-                    } else {
-                        fprintf(stderr, "Mem realloc error: %d\n", errno);
-                        finish = 1;
-                        break;
-                    };
+                if (add_pulsepair(pulsepairs, (uint32_t)pulse, (uint32_t)pause) != 0) {
+                    fprintf(stderr, "Mem realloc error: %d\n", errno);
+                    break;
                 };
-                pulsepairs->pairs[size][0] = pulse;
-                pulsepairs->pairs[size][1] = pause;
-//                printf( "add Pulse/Pause IR : %ld / %ld\n", pulsepairs->pairs[size][0], pulsepairs->pairs[size][1]);
-                size += 1;
                 pulse = pause =0;
             };
         };
         value = vread;
     };
-    if (size < PULSEPAIR_MINPAIRS) {
+    realtime_leave(&saved);
+    TRACE(TRACE_PULSEPAIRS_WATCH, pulsepairs->size);
+    if (pulsepairs->size < PULSEPAIR_MINPAIRS) {
 //        printf("No valide pulse/pause pairs detected");
         return 0;
     }
-//    printf("codeIR : %d pairs, pulse %ld, pause %ld, value %d, nbpulse %ld\n", pulsepairs->size, pulse, pause, value, nbPulse);
     return 1;
 }
 
+// Free the pulse/pause buffer, the PulsePairs struct itself belongs to the caller.
 void free_plusepairs(PulsePairs *pulsepairs)
 {
-    int i;
-    int size = num_pulsepairs(pulsepairs);
-    printf("Free plusepairs size : %d\n", size);
-    if (pulsepairs->pairs != NULL) {
-        for (i = 0; i < size; i++) {
-            free(pulsepairs->pairs[i]);
-        };
+    TRACE(TRACE_PULSEPAIRS_FREE, num_pulsepairs(pulsepairs));
+    if (pulsepairs->pairs != NULL && pulsepairs->capacity != 0)
         free(pulsepairs->pairs);
-        pulsepairs->pairs = NULL;
-        free(pulsepairs);
-    };
+    pulsepairs->pairs = NULL;
+    pulsepairs->size = 0;
+    pulsepairs->capacity = 0;
 }
 
 int num_pulsepairs(PulsePairs *pulsepairs)
 {
     if (pulsepairs !=NULL) {
         if (pulsepairs->pairs != NULL) {
-            int size = pulsepairs->size;
-            printf("num_pulsepairs  = %d\n", size);
-            return size;
+            return pulsepairs->size;
         };
     };
     return 0;
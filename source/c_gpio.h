@@ -20,20 +20,36 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-typedef struct PulsePair PulsePair;
-struct PulsePair
-{
-    long pulse;
-    long pause;
-};
+#include <stdint.h>
 
+// Flat pulse/pause buffer : pairs[2*i] is the pulse and pairs[2*i+1] the pause of pair i, in us.
+// capacity is the number of pairs allocated, 0 when pairs is borrowed and must not be freed.
 typedef struct PulsePairs PulsePairs;
 struct PulsePairs
-{ 
-    int **pairs;
+{
+    uint32_t *pairs;
     unsigned int size;
+    unsigned int capacity;
 };
 
+#define PULSEPAIR_PULSE(pp, i) ((pp)->pairs[2*(i)])
+#define PULSEPAIR_PAUSE(pp, i) ((pp)->pairs[2*(i)+1])
+
+// Pin handle : register pointers and bit mask of one gpio resolved once by pin_init(),
+// so a write or read is a single volatile access without index math.
+typedef struct GpioPin GpioPin;
+struct GpioPin
+{
+    unsigned int gpio;
+    volatile uint32_t *set;     // GPSETn word of the pin
+    volatile uint32_t *clr;     // GPCLRn word of the pin
+    volatile uint32_t *lev;     // GPLEVn word of the pin
+    uint32_t mask;              // 1 << (gpio % 32)
+};
+
+#define PIN_WRITE(pin, value) (*((value) ? (pin)->set : (pin)->clr) = (pin)->mask)
+#define PIN_READ(pin) ((*(pin)->lev & (pin)->mask) != 0)
+
 int setup(void);
 void setup_gpio(int gpio, int direction, int pud);
 int gpio_function(int gpio);
@@ -44,18 +60,34 @@ void set_falling_event(int gpio, int enable);
 void set_high_event(int gpio, int enable);
 void set_low_event(int gpio, int enable);
 int eventdetected(int gpio);
+void setup_map(volatile uint32_t *map);
+uint64_t event_mask(void);
+void clear_event_mask(uint64_t mask);
+uint64_t level_mask(void);
+void output_gpio_mask(uint64_t set, uint64_t clr);
+void pin_init(GpioPin *pin, int gpio);
+int pin_pulse(GpioPin *pin, int value, unsigned int us);
 void cleanup(void);
 int init_bcm2835(void);
+extern int BMC2835_IsInit;
 void close_bcm2835(void);
 void init_pwm(int gpio, int pwm_channel, int divider, int range);
+void release_pwm(int pwm_channel);
+int pwm_channel_free(int pwm_channel, unsigned int divider);
 int pwm_setclock(unsigned int divider);
 int pwm_setrange(unsigned int pwm_channel, unsigned int range);
 int pwm_setlevel(unsigned int pwm_channel, unsigned int range);
-int pwm_pulsepause(int pwm_channel, long tpulse, long tpause, int range, PulsePair *pair);
-int gpio_pulsepause(int gpio, long tpulse, long tpause, PulsePair *pair);
+long pwm_sendpulsepairs(int pwm_channel, PulsePairs *pulsepairs, unsigned int data, PulsePairs *report);
+void pwm_setdivider(unsigned int divider);
+int pwm_gpio_channel(int gpio, int *alt);
+int pwm_setcarrier(int gpio, float frequency, float dutycycle, unsigned int *data, int *fsel);
+int gpio_sendpulsepairs(int gpio, PulsePairs *pulsepairs, float frequency, float dutycycle, PulsePairs *report, long *drift);
+int init_pulsepairs(PulsePairs *pulsepairs, unsigned int capacity);
+int add_pulsepair(PulsePairs *pulsepairs, uint32_t pulse, uint32_t pause);
 int gpio_watchpulsepairs(int gpio, PulsePairs *pulsepairs);
 void free_plusepairs(PulsePairs *pulsepairs);
 int num_pulsepairs(PulsePairs *pulsepairs);
+uint64_t wait_deadline(uint64_t deadline);
 long delta_time_in_microseconds (struct timeval * t2, struct timeval * t1);
 
 #define SETUP_OK          0
@@ -76,3 +108,12 @@ long delta_time_in_microseconds (struct timeval * t2, struct timeval * t1);
 
 #define PULSEPAIR_TIMEOUTSTAGE 65000  // time-out in us for report non pulsepair
 #define PULSEPAIR_MINPAIRS 5 // minimal pairs number for consider a code
+#define PULSEPAIR_DEFAULTCAPACITY 256 // pairs preallocated for a capture, enough for long AC remote frames
+#define PULSEPAIR_SLEEPTHRESHOLD 450 // above this wait in us, sleep before busy-waiting on the system timer
+#define PULSEPAIR_SLEEPMARGIN 200 // nanosleep overshoot in us, busy-waited instead
+
+#define IR_CARRIER_FREQUENCY 38000.0 // default carrier frequency in Hz
+#define IR_CARRIER_DUTYCYCLE 50.0    // default carrier duty cycle in %
+#define IR_CARRIER_DIVIDER   2       // PWM clock divider for carrier, 9.6 MHz gives ~0.1% frequency resolution at 38 kHz
+#define PWM_CLOCK_FREQUENCY  19200000 // PWM oscillator clock in Hz
+#define PWM_BUSY             -2       // PWM channel or clock used by a PWM2835
@@ -24,6 +24,8 @@ SOFTWARE.
 #include "c_gpio.h"
 #include "common.h"
 
+#include <string.h>
+
 int gpio_mode = MODE_UNKNOWN;
 const int pin_to_gpio_rev1[27] = {-1, -1, -1, 0, -1, 1, -1, 4, 14, -1, 15, 17, 18, 21, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7};
 const int pin_to_gpio_rev2[27] = {-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1, 9, 25, 11, 8, -1, 7};
@@ -80,3 +82,154 @@ int get_gpio_number(int channel, unsigned int *gpio)
 
     return 0;
 }
+
+// Fill pulsepairs from a python list of [pulse, pause] lists, in one allocation sized for the list.
+// Return 0 on success, otherwise set a python exception and return -1.
+int pulsepairs_from_list(PyObject *tab, PulsePairs *pulsepairs)
+{
+    Py_ssize_t i, size;
+    PyObject *item;
+    unsigned long pulse, pause = 0;
+
+    size = PyList_Size(tab);
+    if (size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "Empty pulse / pairs table");
+        return -1;
+    }
+    if (init_pulsepairs(pulsepairs, (unsigned int)size) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < size; i++) {
+        item = PyList_GetItem(tab, i); /* Can't fail */
+        if (!PyList_Check(item)) {
+            PyErr_SetString(PyExc_ValueError, "Not a list pulse pair format.");
+            free_plusepairs(pulsepairs);
+            return -1;
+        }
+        if (PyList_Size(item) != 2) {
+            PyErr_SetString(PyExc_ValueError, "Not a pulse pair format.");
+            free_plusepairs(pulsepairs);
+            return -1;
+        }
+        // Negative values raise OverflowError here
+        pulse = PyLong_AsUnsignedLong(PyList_GetItem(item, 0));
+        if (!PyErr_Occurred())
+            pause = PyLong_AsUnsignedLong(PyList_GetItem(item, 1));
+        if (PyErr_Occurred()) {
+            free_plusepairs(pulsepairs);
+            return -1;
+        }
+        if (pulse > UINT32_MAX || pause > UINT32_MAX) {
+            PyErr_SetString(PyExc_OverflowError, "Pulse and pause must be positive durations in us below 2^32.");
+            free_plusepairs(pulsepairs);
+            return -1;
+        }
+        PULSEPAIR_PULSE(pulsepairs, i) = (uint32_t)pulse;
+        PULSEPAIR_PAUSE(pulsepairs, i) = (uint32_t)pause;
+    }
+    pulsepairs->size = (unsigned int)size;
+    return 0;
+}
+
+// Return 1 if a buffer format describes 32 bits unsigned integers (array('I'), numpy.uint32, ...)
+static int is_uint32_format(const char *format, Py_ssize_t itemsize)
+{
+    if (itemsize != 4 || format == NULL)
+        return 0;
+    if (*format == '@' || *format == '=' || *format == '<')
+        format++;
+    return (strcmp(format, "I") == 0 || strcmp(format, "L") == 0);
+}
+
+// Map pulsepairs on a list of [pulse, pause] lists (copied) or on any object supporting the buffer
+// protocol with flat interleaved pulse/pause uint32 (read in place, never copied nor written).
+// Return 0 on success, otherwise set a python exception and return -1.
+// Call pulsepairs_release() with the same view when done.
+int pulsepairs_from_object(PyObject *obj, PulsePairs *pulsepairs, Py_buffer *view)
+{
+    Py_ssize_t count;
+
+    view->obj = NULL;
+    if (PyList_Check(obj))
+        return pulsepairs_from_list(obj, pulsepairs);
+
+    if (!PyObject_CheckBuffer(obj)) {
+        PyErr_SetString(PyExc_TypeError, "Pulse / pause pairs must be a list of pairs or a uint32 buffer.");
+        return -1;
+    }
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        return -1;
+    if (!is_uint32_format(view->format, view->itemsize)) {
+        PyErr_SetString(PyExc_ValueError, "Pulse / pause buffer must hold uint32 items.");
+        PyBuffer_Release(view);
+        return -1;
+    }
+    count = view->len / view->itemsize;
+    if (count == 0 || count % 2) {
+        PyErr_SetString(PyExc_ValueError, "Pulse / pause buffer must hold a non zero even number of items.");
+        PyBuffer_Release(view);
+        return -1;
+    }
+    pulsepairs->pairs = (uint32_t *)view->buf;
+    pulsepairs->size = (unsigned int)(count / 2);
+    pulsepairs->capacity = 0;   // borrowed from the buffer
+    return 0;
+}
+
+void pulsepairs_release(PulsePairs *pulsepairs, Py_buffer *view)
+{
+    free_plusepairs(pulsepairs);
+    if (view->obj != NULL)
+        PyBuffer_Release(view);
+}
+
+// Give a buffer to report measured values for pulsepairs : pulsepairs itself when we own it,
+// else a new one sized once before sending. Return 0 on success, otherwise set a python exception
+// and return -1. measured must be freed by free_plusepairs(), which is a no-op when it is shared.
+int pulsepairs_measure_buffer(PulsePairs *pulsepairs, PulsePairs *measured)
+{
+    if (pulsepairs->capacity != 0) {
+        measured->pairs = pulsepairs->pairs;
+        measured->size = pulsepairs->size;
+        measured->capacity = 0;
+        return 0;
+    }
+    if (init_pulsepairs(measured, pulsepairs->size) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    measured->size = pulsepairs->size;
+    return 0;
+}
+
+// Build a python list of (pulse, pause) tuples from pulsepairs.
+PyObject *pulsepairs_to_list(PulsePairs *pulsepairs)
+{
+    unsigned int i;
+    PyObject *item;
+    PyObject *result = PyList_New(pulsepairs->size);
+
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < pulsepairs->size; i++) {
+        item = Py_BuildValue("(kk)", (unsigned long)PULSEPAIR_PULSE(pulsepairs, i), (unsigned long)PULSEPAIR_PAUSE(pulsepairs, i));
+        if (item == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+    return result;
+}
+
+// Build the python transmit report (jitter, drift) : a list of (pulse edge, pause edge) lateness
+// in us and the drift in us of the frame end.
+PyObject *pulsepairs_to_report(PulsePairs *jitter, long drift)
+{
+    PyObject *list = pulsepairs_to_list(jitter);
+
+    if (list == NULL)
+        return NULL;
+    return Py_BuildValue("(Nl)", list, drift);
+}
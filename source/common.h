@@ -36,5 +36,12 @@ int gpio_direction[54];
 int revision;
 
 int get_gpio_number(int channel, unsigned int *gpio);
+int setup_channel(int channel, int direction, int pud, int initial, unsigned int *gpio);
+int pulsepairs_from_list(PyObject *tab, PulsePairs *pulsepairs);
+int pulsepairs_from_object(PyObject *obj, PulsePairs *pulsepairs, Py_buffer *view);
+void pulsepairs_release(PulsePairs *pulsepairs, Py_buffer *view);
+int pulsepairs_measure_buffer(PulsePairs *pulsepairs, PulsePairs *measured);
+PyObject *pulsepairs_to_list(PulsePairs *pulsepairs);
+PyObject *pulsepairs_to_report(PulsePairs *jitter, long drift);
 int setup_error;
 int module_setup;
@@ -22,9 +22,12 @@ SOFTWARE.
 
 #include "Python.h"
 #include "constants.h"
-#include "common.h"
 #include "c_gpio.h"
+#include "common.h"
 #include "event_gpio.h"
+#include "realtime.h"
+#include "trace.h"
+#include "pwm_ramp.h"
 #include "bcm2835.h"
 
 void define_constants(PyObject *module)
@@ -80,6 +83,72 @@ void define_constants(PyObject *module)
    both_edge = Py_BuildValue("i", BOTH_EDGE + PY_EVENT_CONST_OFFSET);
    PyModule_AddObject(module, "BOTH", both_edge);
 
+   event_sysfs = Py_BuildValue("i", EVENT_BACKEND_SYSFS);
+   PyModule_AddObject(module, "EVENT_SYSFS", event_sysfs);
+
+   event_cdev = Py_BuildValue("i", EVENT_BACKEND_CDEV);
+   PyModule_AddObject(module, "EVENT_CDEV", event_cdev);
+
+   event_regs = Py_BuildValue("i", EVENT_BACKEND_REGS);
+   PyModule_AddObject(module, "EVENT_REGS", event_regs);
+
+   debounce_ignore = Py_BuildValue("i", DEBOUNCE_IGNORE);
+   PyModule_AddObject(module, "DEBOUNCE_IGNORE", debounce_ignore);
+
+   debounce_stable = Py_BuildValue("i", DEBOUNCE_STABLE);
+   PyModule_AddObject(module, "DEBOUNCE_STABLE", debounce_stable);
+
+   sched_other = Py_BuildValue("i", SCHED_OTHER);
+   PyModule_AddObject(module, "SCHED_OTHER", sched_other);
+
+   sched_fifo = Py_BuildValue("i", SCHED_FIFO);
+   PyModule_AddObject(module, "SCHED_FIFO", sched_fifo);
+
+   sched_rr = Py_BuildValue("i", SCHED_RR);
+   PyModule_AddObject(module, "SCHED_RR", sched_rr);
+
+   realtime_threads = Py_BuildValue("i", REALTIME_THREADS);
+   PyModule_AddObject(module, "REALTIME_THREADS", realtime_threads);
+
+   realtime_calls = Py_BuildValue("i", REALTIME_CALLS);
+   PyModule_AddObject(module, "REALTIME_CALLS", realtime_calls);
+
+   trace_bcm2835_init = Py_BuildValue("i", TRACE_BCM2835_INIT);
+   PyModule_AddObject(module, "TRACE_BCM2835_INIT", trace_bcm2835_init);
+
+   trace_pulsepairs_send = Py_BuildValue("i", TRACE_PULSEPAIRS_SEND);
+   PyModule_AddObject(module, "TRACE_PULSEPAIRS_SEND", trace_pulsepairs_send);
+
+   trace_pulsepairs_sent = Py_BuildValue("i", TRACE_PULSEPAIRS_SENT);
+   PyModule_AddObject(module, "TRACE_PULSEPAIRS_SENT", trace_pulsepairs_sent);
+
+   trace_pulsepairs_watch = Py_BuildValue("i", TRACE_PULSEPAIRS_WATCH);
+   PyModule_AddObject(module, "TRACE_PULSEPAIRS_WATCH", trace_pulsepairs_watch);
+
+   trace_pulsepairs_free = Py_BuildValue("i", TRACE_PULSEPAIRS_FREE);
+   PyModule_AddObject(module, "TRACE_PULSEPAIRS_FREE", trace_pulsepairs_free);
+
+   trace_pwm2835_init = Py_BuildValue("i", TRACE_PWM2835_INIT);
+   PyModule_AddObject(module, "TRACE_PWM2835_INIT", trace_pwm2835_init);
+
+   trace_soft_pwm_edges = Py_BuildValue("i", TRACE_SOFT_PWM_EDGES);
+   PyModule_AddObject(module, "TRACE_SOFT_PWM_EDGES", trace_soft_pwm_edges);
+
+   trace_soft_pwm_clear = Py_BuildValue("i", TRACE_SOFT_PWM_CLEAR);
+   PyModule_AddObject(module, "TRACE_SOFT_PWM_CLEAR", trace_soft_pwm_clear);
+
+   trace_pwm_ramp = Py_BuildValue("i", TRACE_PWM_RAMP);
+   PyModule_AddObject(module, "TRACE_PWM_RAMP", trace_pwm_ramp);
+
+   ramp_linear = Py_BuildValue("i", RAMP_LINEAR);
+   PyModule_AddObject(module, "RAMP_LINEAR", ramp_linear);
+
+   ramp_exponential = Py_BuildValue("i", RAMP_EXPONENTIAL);
+   PyModule_AddObject(module, "RAMP_EXPONENTIAL", ramp_exponential);
+
+   ramp_gamma = Py_BuildValue("i", RAMP_GAMMA);
+   PyModule_AddObject(module, "RAMP_GAMMA", ramp_gamma);
+
    version = Py_BuildValue("s", "0.5.5");
    PyModule_AddObject(module, "VERSION", version);
 }
@@ -40,6 +40,28 @@ PyObject *pud_down;
 PyObject *rising_edge;
 PyObject *falling_edge;
 PyObject *both_edge;
+PyObject *event_sysfs;
+PyObject *event_cdev;
+PyObject *event_regs;
+PyObject *debounce_ignore;
+PyObject *debounce_stable;
+PyObject *sched_other;
+PyObject *sched_fifo;
+PyObject *sched_rr;
+PyObject *realtime_threads;
+PyObject *realtime_calls;
+PyObject *trace_bcm2835_init;
+PyObject *trace_pulsepairs_send;
+PyObject *trace_pulsepairs_sent;
+PyObject *trace_pulsepairs_watch;
+PyObject *trace_pulsepairs_free;
+PyObject *trace_pwm2835_init;
+PyObject *trace_soft_pwm_edges;
+PyObject *trace_soft_pwm_clear;
+PyObject *trace_pwm_ramp;
+PyObject *ramp_linear;
+PyObject *ramp_exponential;
+PyObject *ramp_gamma;
 PyObject *version;
 
 void define_constants(PyObject *module);
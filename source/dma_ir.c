@@ -0,0 +1,499 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "c_gpio.h"
+#include "dma_ir.h"
+#include "bcm2835.h"
+
+// DMA channel registers, word offsets from the channel base
+#define DMA_CS        0
+#define DMA_CONBLK_AD 1
+#define DMA_DEBUG     8
+#define DMA_CHANNEL_OFFSET (0x100/4)
+#define DMA_ENABLE    (0xff0/4)
+
+#define DMA_CS_ACTIVE   (1 << 0)
+#define DMA_CS_END      (1 << 1)
+#define DMA_CS_INT      (1 << 2)
+#define DMA_CS_PRIORITY(x)       ((x) << 16)
+#define DMA_CS_PANIC_PRIORITY(x) ((x) << 20)
+#define DMA_CS_WAIT_WRITES       (1 << 28)
+#define DMA_CS_RESET    (1 << 31)
+
+#define DMA_TI_WAIT_RESP   (1 << 3)
+#define DMA_TI_DEST_DREQ   (1 << 6)
+#define DMA_TI_PERMAP(x)   ((x) << 16)
+#define DMA_TI_NO_WIDE_BURSTS (1 << 26)
+#define DMA_PERMAP_PWM     5
+
+#define DMA_IR_FIFO_DEPTH  16   // PWM FIFO words, filled once before the first edge
+#define DMA_IR_TIMEOUT_MARGIN 100000 // us waited after the frame duration before aborting
+
+// Bus address of a location inside buffer
+uint32_t dma_bus_addr(DmaBuffer *buffer, void *virt)
+{
+    uint32_t offset = (uint32_t)((uint8_t *)virt - buffer->virt);
+    return buffer->bus[offset / BCM2835_PAGE_SIZE] + offset % BCM2835_PAGE_SIZE;
+}
+
+// Number of paced control blocks needed to wait ticks
+static unsigned int delay_count(uint32_t ticks)
+{
+    return (ticks * 4 + DMA_IR_LITE_MAXLEN - 1) / DMA_IR_LITE_MAXLEN;
+}
+
+// Number of control block slots needed to send pulsepairs, the word slot and the FIFO priming included
+unsigned int dma_ir_count(PulsePairs *pulsepairs, unsigned int tick)
+{
+    unsigned int i, count = 2;
+
+    for (i = 0; i < pulsepairs->size; i++) {
+        count += 2;
+        count += delay_count((PULSEPAIR_PULSE(pulsepairs, i) + tick / 2) / tick);
+        count += delay_count((PULSEPAIR_PAUSE(pulsepairs, i) + tick / 2) / tick);
+    }
+    return count;
+}
+
+static dma_cb *add_write(dma_cb *cb, uint32_t src, uint32_t dst)
+{
+    cb->info = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP;
+    cb->src = src;
+    cb->dst = dst;
+    cb->length = 4;
+    cb->stride = 0;
+    return cb + 1;
+}
+
+static dma_cb *add_delay(dma_cb *cb, uint32_t src, uint32_t fifo, uint32_t ticks)
+{
+    uint32_t length;
+
+    while (ticks > 0) {
+        length = ticks * 4 > DMA_IR_LITE_MAXLEN ? DMA_IR_LITE_MAXLEN : ticks * 4;
+        cb->info = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_PERMAP_PWM);
+        cb->src = src;
+        cb->dst = fifo;
+        cb->length = length;
+        cb->stride = 0;
+        ticks -= length / 4;
+        cb++;
+    }
+    return cb;
+}
+
+// Build in buffer the control block chain sending pulsepairs, durations rounded to tick us.
+// With carrier the chain writes on / 0 in the PWM data register, otherwise it writes the gpio mask
+// on in GPSET0 / GPCLR0. Only bus addresses from buffer and regs are used, so the chain can be
+// built and checked against any memory image. Return the number of slots used, -1 if too small.
+int dma_ir_build(DmaBuffer *buffer, DmaRegs *regs, PulsePairs *pulsepairs, unsigned int tick, int carrier, uint32_t on)
+{
+    unsigned int i, count = dma_ir_count(pulsepairs, tick);
+    dma_cb *cbs = (dma_cb *)buffer->virt;
+    dma_cb *cb;
+    uint32_t *words = (uint32_t *)&cbs[0];
+    uint32_t w_on, w_off, w_pace;
+
+    if (count * sizeof(dma_cb) > buffer->pages * BCM2835_PAGE_SIZE)
+        return -1;
+
+    memset(cbs, 0, count * sizeof(dma_cb));
+    words[DMA_IR_WORD_ON] = on;
+    words[DMA_IR_WORD_OFF] = 0;
+    words[DMA_IR_WORD_PACE] = 0;
+    w_on = dma_bus_addr(buffer, &words[DMA_IR_WORD_ON]);
+    w_off = dma_bus_addr(buffer, &words[DMA_IR_WORD_OFF]);
+    w_pace = dma_bus_addr(buffer, &words[DMA_IR_WORD_PACE]);
+
+    // fill the FIFO first, so every following word waits one tick
+    cb = &cbs[1];
+    cb->info = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_PERMAP_PWM);
+    cb->src = w_pace;
+    cb->dst = regs->pwm_fifo;
+    cb->length = DMA_IR_FIFO_DEPTH * 4;
+    cb++;
+    for (i = 0; i < pulsepairs->size; i++) {
+        if (carrier)
+            cb = add_write(cb, w_on, regs->pwm_data);
+        else
+            cb = add_write(cb, w_on, regs->gpset);
+        cb = add_delay(cb, w_pace, regs->pwm_fifo, (PULSEPAIR_PULSE(pulsepairs, i) + tick / 2) / tick);
+        if (carrier)
+            cb = add_write(cb, w_off, regs->pwm_data);
+        else
+            cb = add_write(cb, w_on, regs->gpclr);
+        cb = add_delay(cb, w_pace, regs->pwm_fifo, (PULSEPAIR_PAUSE(pulsepairs, i) + tick / 2) / tick);
+    }
+
+    // link the chain, the last block stops the channel
+    for (i = 1; i < count - 1; i++)
+        cbs[i].next = dma_bus_addr(buffer, &cbs[i + 1]);
+    cbs[count - 1].next = 0;
+    return count;
+}
+
+// Allocate size bytes of page locked memory and look up the bus address of each page.
+// Return 0 on success, -1 on error.
+int dma_alloc(DmaBuffer *buffer, unsigned int size)
+{
+    unsigned int i;
+    int fd;
+    uint64_t entry;
+    void *mem;
+
+    buffer->pages = (size + BCM2835_PAGE_SIZE - 1) / BCM2835_PAGE_SIZE;
+    buffer->virt = NULL;
+    buffer->bus = malloc(sizeof(uint32_t) * buffer->pages);
+    if (buffer->bus == NULL)
+        return -1;
+    if (posix_memalign(&mem, BCM2835_PAGE_SIZE, buffer->pages * BCM2835_PAGE_SIZE) != 0) {
+        dma_free(buffer);
+        return -1;
+    }
+    buffer->virt = mem;
+    memset(buffer->virt, 0, buffer->pages * BCM2835_PAGE_SIZE);   // fault the pages in
+    if (mlock(buffer->virt, buffer->pages * BCM2835_PAGE_SIZE) != 0) {
+        dma_free(buffer);
+        return -1;
+    }
+    if ((fd = open("/proc/self/pagemap", O_RDONLY)) < 0) {
+        dma_free(buffer);
+        return -1;
+    }
+    for (i = 0; i < buffer->pages; i++) {
+        off_t offset = (off_t)((uintptr_t)(buffer->virt + i * BCM2835_PAGE_SIZE) / BCM2835_PAGE_SIZE) * sizeof(entry);
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry) || !(entry & (1ULL << 63))) {
+            close(fd);
+            dma_free(buffer);
+            return -1;
+        }
+        buffer->bus[i] = (uint32_t)((entry & ((1ULL << 55) - 1)) * BCM2835_PAGE_SIZE) | DMA_BUS_ALIAS;
+    }
+    close(fd);
+    return 0;
+}
+
+void dma_free(DmaBuffer *buffer)
+{
+    if (buffer->virt != NULL) {
+        munlock(buffer->virt, buffer->pages * BCM2835_PAGE_SIZE);
+        free(buffer->virt);
+        buffer->virt = NULL;
+    }
+    free(buffer->bus);
+    buffer->bus = NULL;
+}
+
+// Send pulsepairs on gpio without CPU involvement during the frame. The carrier is made by the
+// PWM peripheral at frequency / dutycycle on gpios with a PWM output, the other PWM channel
+// paces the chain. With frequency 0 or on other gpios (0 to 31) the gpio itself is gated.
+// Return DMA_IR_OK or an error, DMA_IR_PWM_BUSY with nothing changed when a PWM2835 uses one
+// of the PWM channels needed or the clock.
+int dma_ir_send(int gpio, PulsePairs *pulsepairs, float frequency, float dutycycle)
+{
+    DmaBuffer buffer;
+    DmaRegs regs;
+    volatile uint32_t *dma;
+    unsigned int i, count, data = 0, pace, control;
+    int channel = -1, fsel = 0, alt;
+    uint64_t duration = 0, deadline;
+    int result = DMA_IR_OK;
+
+    if (bcm2835_dma == MAP_FAILED)
+        return DMA_IR_NOT_MAPPED;
+
+    // the pacing channel is taken over for the frame and disabled after, it must not be a PWM2835's
+    if (frequency > 0.0 && (channel = pwm_gpio_channel(gpio, &alt)) != -1)
+        pace = channel ? 0 : 1;
+    else
+        pace = 1;
+    if (!pwm_channel_free(pace, IR_CARRIER_DIVIDER))
+        return DMA_IR_PWM_BUSY;
+
+    if (frequency > 0.0)
+        channel = pwm_setcarrier(gpio, frequency, dutycycle, &data, &fsel);
+    if (channel == PWM_BUSY)
+        return DMA_IR_PWM_BUSY;
+    if (channel == -1) {
+        if (gpio > 31)
+            return DMA_IR_NOT_MAPPED;
+        bcm2835_gpio_fsel(gpio, BCM2835_GPIO_FSEL_OUTP);
+        bcm2835_gpio_clr(gpio);
+        pwm_setdivider(IR_CARRIER_DIVIDER);
+    }
+
+    regs.gpset = BCM2835_PERI_BUS_BASE + (BCM2835_GPIO_BASE - BCM2835_PERI_BASE) + BCM2835_GPSET0;
+    regs.gpclr = BCM2835_PERI_BUS_BASE + (BCM2835_GPIO_BASE - BCM2835_PERI_BASE) + BCM2835_GPCLR0;
+    regs.pwm_data = BCM2835_PERI_BUS_BASE + (BCM2835_GPIO_PWM - BCM2835_PERI_BASE) + 4 * (channel == 1 ? BCM2835_PWM1_DATA : BCM2835_PWM0_DATA);
+    regs.pwm_fifo = BCM2835_PERI_BUS_BASE + (BCM2835_GPIO_PWM - BCM2835_PERI_BASE) + 4 * BCM2835_PWM_FIF1;
+
+    count = dma_ir_count(pulsepairs, DMA_IR_TICK);
+    if (dma_alloc(&buffer, count * sizeof(dma_cb)) != 0)
+        return DMA_IR_MEM_FAIL;
+    dma_ir_build(&buffer, &regs, pulsepairs, DMA_IR_TICK, channel != -1, channel != -1 ? data : (1u << gpio));
+    for (i = 0; i < pulsepairs->size; i++)
+        duration += (uint64_t)PULSEPAIR_PULSE(pulsepairs, i) + PULSEPAIR_PAUSE(pulsepairs, i);
+
+    // pacing channel consumes one FIFO word per tick
+    bcm2835_pwm_set_range(pace, (uint32_t)((uint64_t)PWM_CLOCK_FREQUENCY * DMA_IR_TICK / IR_CARRIER_DIVIDER / 1000000));
+    control = bcm2835_peri_read(bcm2835_pwm + BCM2835_PWM_CONTROL);
+    bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_CONTROL, control | BCM2835_PWM_CLEAR_FIFO);
+    bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_DMAC, BCM2835_PWM_DMAC_ENAB | (7 << 8) | 7);
+    if (pace == 0)
+        control = (control & ~BCM2835_PWM0_MS_MODE) | BCM2835_PWM0_USEFIFO | BCM2835_PWM0_ENABLE;
+    else
+        control = (control & ~BCM2835_PWM1_MS_MODE) | BCM2835_PWM1_USEFIFO | BCM2835_PWM1_ENABLE;
+    bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_CONTROL, control);
+
+    // start the chain
+    dma = bcm2835_dma + DMA_IR_CHANNEL * DMA_CHANNEL_OFFSET;
+    bcm2835_peri_write(bcm2835_dma + DMA_ENABLE, bcm2835_peri_read(bcm2835_dma + DMA_ENABLE) | (1 << DMA_IR_CHANNEL));
+    bcm2835_peri_write(dma + DMA_CS, DMA_CS_RESET);
+    bcm2835_delayMicroseconds(10);
+    bcm2835_peri_write(dma + DMA_CS, DMA_CS_INT | DMA_CS_END);
+    bcm2835_peri_write(dma + DMA_DEBUG, 7);    // clear error flags
+    bcm2835_peri_write(dma + DMA_CONBLK_AD, dma_bus_addr(&buffer, buffer.virt + sizeof(dma_cb)));
+    bcm2835_peri_write(dma + DMA_CS, DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_PRIORITY(15) | DMA_CS_ACTIVE);
+
+    // the frame plays on its own, just sleep until the channel is done
+    deadline = bcm2835_st_read() + duration + DMA_IR_TIMEOUT_MARGIN;
+    while (bcm2835_peri_read(dma + DMA_CS) & DMA_CS_ACTIVE) {
+        if (bcm2835_st_read() > deadline) {
+            bcm2835_peri_write(dma + DMA_CS, DMA_CS_RESET);
+            result = DMA_IR_TIMEOUT;
+            break;
+        }
+        bcm2835_delay(1);
+    }
+
+    // stop pacing and leave the output off
+    bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_DMAC, 0);
+    if (pace == 0)
+        control &= ~(BCM2835_PWM0_USEFIFO | BCM2835_PWM0_ENABLE);
+    else
+        control &= ~(BCM2835_PWM1_USEFIFO | BCM2835_PWM1_ENABLE);
+    bcm2835_peri_write_nb(bcm2835_pwm + BCM2835_PWM_CONTROL, control);
+    if (channel != -1) {
+        bcm2835_pwm_set_data(channel, 0);
+        bcm2835_gpio_fsel(gpio, fsel);  // the pin is a plain gpio again
+    } else
+        bcm2835_gpio_clr(gpio);
+    dma_free(&buffer);
+    return result;
+}
+
+#ifdef DMA_IR_TEST
+// Builds a chain in plain memory and replays it against an in-memory register image, with a
+// minimal model of the DMA controller and of the PWM FIFO pacing. No hardware access.
+// gcc dma_ir.c c_gpio.c bcm2835.c realtime.c trace.c -lpthread -D DMA_IR_TEST
+// ./a.out
+
+#define TEST_BUS_BASE 0xC0000000
+
+static uint32_t test_image[4];
+
+static uint32_t *test_reg(DmaRegs *regs, uint32_t addr)
+{
+    if (addr == regs->gpset) return &test_image[0];
+    if (addr == regs->gpclr) return &test_image[1];
+    if (addr == regs->pwm_data) return &test_image[2];
+    if (addr == regs->pwm_fifo) return &test_image[3];
+    return NULL;
+}
+
+static void *test_virt(DmaBuffer *buffer, uint32_t addr)
+{
+    return buffer->virt + (addr - TEST_BUS_BASE);
+}
+
+// Replay the chain, check that each gate write happens at the expected tick
+static int test_replay(DmaBuffer *buffer, DmaRegs *regs, PulsePairs *pulsepairs, int carrier, uint32_t on)
+{
+    uint32_t addr = dma_bus_addr(buffer, buffer->virt + sizeof(dma_cb));
+    uint32_t *reg, *src;
+    uint64_t tick = 0, expected = 0;
+    unsigned int fifo = 0, words, edge = 0;
+    int errors = 0;
+
+    while (addr != 0) {
+        dma_cb *cb = test_virt(buffer, addr);
+        reg = test_reg(regs, cb->dst);
+        src = test_virt(buffer, cb->src);
+        if (reg == NULL) {
+            printf("FAIL : write to unknown register %08X\n", cb->dst);
+            return 1;
+        }
+        if (cb->info & DMA_TI_DEST_DREQ) {
+            for (words = 0; words < cb->length / 4; words++) {
+                if (fifo < DMA_IR_FIFO_DEPTH)
+                    fifo++;
+                else
+                    tick++;
+            }
+        } else {
+            uint32_t value = *src;
+            uint32_t pair = edge / 2;
+            *reg = value;
+            if (edge % 2 == 0) {
+                if ((carrier && (reg != &test_image[2] || value != on)) || (!carrier && reg != &test_image[0]))
+                    errors++, printf("FAIL : pair %u pulse edge writes %08X\n", pair, value);
+            } else {
+                if ((carrier && (reg != &test_image[2] || value != 0)) || (!carrier && reg != &test_image[1]))
+                    errors++, printf("FAIL : pair %u pause edge writes %08X\n", pair, value);
+            }
+            if (tick != expected)
+                errors++, printf("FAIL : edge %u at tick %llu, expected %llu\n", edge, (unsigned long long)tick, (unsigned long long)expected);
+            if (edge % 2 == 0)
+                expected += (PULSEPAIR_PULSE(pulsepairs, pair) + DMA_IR_TICK / 2) / DMA_IR_TICK;
+            else
+                expected += (PULSEPAIR_PAUSE(pulsepairs, pair) + DMA_IR_TICK / 2) / DMA_IR_TICK;
+            edge++;
+        }
+        addr = cb->next;
+    }
+    if (edge != pulsepairs->size * 2)
+        errors++, printf("FAIL : %u edges, expected %u\n", edge, pulsepairs->size * 2);
+    if (tick != expected)
+        errors++, printf("FAIL : frame ends at tick %llu, expected %llu\n", (unsigned long long)tick, (unsigned long long)expected);
+    return errors;
+}
+
+extern volatile uint32_t *bcm2835_gpio, *bcm2835_pwm, *bcm2835_clk;
+
+// The carrier leaves a PWM2835 alone, and sets its divider again once the PWM2835 is gone or
+// after a clock change, as SetClock() does. The pin gets its function back after a send.
+static int test_carrier_divider(void)
+{
+    static uint32_t gpio[1024], pwm[1024], clk[1024];
+    unsigned int data;
+    int fsel, errors = 0;
+
+    bcm2835_gpio = gpio;
+    bcm2835_pwm = pwm;
+    bcm2835_clk = clk;
+    bcm2835_gpio_fsel(18, BCM2835_GPIO_FSEL_OUTP);
+    if (pwm_setcarrier(18, 38000.0, 33.0, &data, &fsel) != 0 || fsel != BCM2835_GPIO_FSEL_OUTP)
+        errors++, printf("FAIL : gpio function %d not saved\n", fsel);
+    init_pwm(18, 0, 16, 1024);
+    if (clk[BCM2835_PWMCLK_DIV] != (BCM2835_PWM_PASSWRD | (16 << 12)))
+        errors++, printf("FAIL : PWM2835 divider not set, %08X\n", clk[BCM2835_PWMCLK_DIV]);
+    if (pwm_setcarrier(18, 38000.0, 33.0, &data, &fsel) != PWM_BUSY)
+        errors++, printf("FAIL : carrier on the channel of a PWM2835\n");
+    if (pwm_setcarrier(19, 38000.0, 33.0, &data, &fsel) != PWM_BUSY)
+        errors++, printf("FAIL : carrier changes the clock of a PWM2835\n");
+    if (clk[BCM2835_PWMCLK_DIV] != (BCM2835_PWM_PASSWRD | (16 << 12)))
+        errors++, printf("FAIL : PWM2835 divider changed, %08X\n", clk[BCM2835_PWMCLK_DIV]);
+    release_pwm(0);
+    pwm_setcarrier(18, 38000.0, 33.0, &data, &fsel);
+    if (clk[BCM2835_PWMCLK_DIV] != (BCM2835_PWM_PASSWRD | (IR_CARRIER_DIVIDER << 12)))
+        errors++, printf("FAIL : carrier divider %08X after PWM2835\n", clk[BCM2835_PWMCLK_DIV]);
+    pwm_setclock(16);
+    pwm_setcarrier(18, 38000.0, 33.0, &data, &fsel);
+    if (clk[BCM2835_PWMCLK_DIV] != (BCM2835_PWM_PASSWRD | (IR_CARRIER_DIVIDER << 12)))
+        errors++, printf("FAIL : carrier divider %08X after SetClock\n", clk[BCM2835_PWMCLK_DIV]);
+    bcm2835_gpio = bcm2835_pwm = bcm2835_clk = MAP_FAILED;
+    return errors;
+}
+
+extern volatile uint32_t *bcm2835_dma;
+
+// The pacing channel of a send is never taken from a PWM2835
+static int test_pace_busy(void)
+{
+    static uint32_t gpio[1024], pwm[1024], clk[1024], dma[1024];
+    PulsePairs pulsepairs;
+    int errors = 0;
+
+    bcm2835_gpio = gpio;
+    bcm2835_pwm = pwm;
+    bcm2835_clk = clk;
+    bcm2835_dma = dma;
+    init_pulsepairs(&pulsepairs, 1);
+    add_pulsepair(&pulsepairs, 560, 560);
+    init_pwm(19, 1, 16, 1024);
+    pwm[BCM2835_PWM1_RANGE] = 1024;
+    if (dma_ir_send(18, &pulsepairs, 38000.0, 33.0) != DMA_IR_PWM_BUSY)
+        errors++, printf("FAIL : carrier send paced by the channel of a PWM2835\n");
+    if (dma_ir_send(17, &pulsepairs, 0.0, 0.0) != DMA_IR_PWM_BUSY)
+        errors++, printf("FAIL : gpio send paced by the channel of a PWM2835\n");
+    if (pwm[BCM2835_PWM1_RANGE] != 1024 || clk[BCM2835_PWMCLK_DIV] != (BCM2835_PWM_PASSWRD | (16 << 12)))
+        errors++, printf("FAIL : PWM2835 channel changed\n");
+    release_pwm(1);
+    free_plusepairs(&pulsepairs);
+    bcm2835_gpio = bcm2835_pwm = bcm2835_clk = bcm2835_dma = MAP_FAILED;
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    DmaBuffer buffer;
+    DmaRegs regs = { 0x7E20001C, 0x7E200028, 0x7E20C014, 0x7E20C018 };
+    PulsePairs pulsepairs;
+    unsigned int i, count;
+    void *mem;
+    int errors = 0;
+
+    init_pulsepairs(&pulsepairs, 4);
+    add_pulsepair(&pulsepairs, 9000, 4500);
+    for (i = 0; i < 32; i++)
+        add_pulsepair(&pulsepairs, 560, i % 2 ? 1690 : 560);
+    add_pulsepair(&pulsepairs, 560, 400000);     // long gap, needs several lite control blocks
+
+    count = dma_ir_count(&pulsepairs, DMA_IR_TICK);
+    buffer.pages = (count * sizeof(dma_cb) + BCM2835_PAGE_SIZE - 1) / BCM2835_PAGE_SIZE;
+    if (posix_memalign(&mem, BCM2835_PAGE_SIZE, buffer.pages * BCM2835_PAGE_SIZE) != 0) {
+        printf("FAIL : no memory\n");
+        return 1;
+    }
+    buffer.virt = mem;
+    buffer.bus = malloc(sizeof(uint32_t) * buffer.pages);
+    for (i = 0; i < buffer.pages; i++)
+        buffer.bus[i] = TEST_BUS_BASE + i * BCM2835_PAGE_SIZE;
+
+    if (dma_ir_build(&buffer, &regs, &pulsepairs, DMA_IR_TICK, 1, 126) != (int)count)
+        errors++, printf("FAIL : carrier chain size\n");
+    errors += test_replay(&buffer, &regs, &pulsepairs, 1, 126);
+    if (dma_ir_build(&buffer, &regs, &pulsepairs, DMA_IR_TICK, 0, 1 << 17) != (int)count)
+        errors++, printf("FAIL : gpio chain size\n");
+    errors += test_replay(&buffer, &regs, &pulsepairs, 0, 1 << 17);
+
+    buffer.pages = 0;
+    if (dma_ir_build(&buffer, &regs, &pulsepairs, DMA_IR_TICK, 1, 126) != -1)
+        errors++, printf("FAIL : overflow not detected\n");
+    errors += test_carrier_divider();
+    errors += test_pace_busy();
+
+    printf("%s : %u control blocks, %d error(s)\n", errors ? "FAIL" : "OK", count, errors);
+    free(mem);
+    free(buffer.bus);
+    free_plusepairs(&pulsepairs);
+    return errors ? 1 : 0;
+}
+#endif
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* IR transmit by DMA : a control block chain gates the carrier and is paced by the PWM FIFO */
+
+// DMA control block, must be 32 bytes aligned
+typedef struct dma_cb dma_cb;
+struct dma_cb
+{
+    uint32_t info;
+    uint32_t src;
+    uint32_t dst;
+    uint32_t length;
+    uint32_t stride;
+    uint32_t next;
+    uint32_t pad[2];
+};
+
+// Page locked memory seen by the DMA controller, bus[i] is the bus address of page i
+typedef struct DmaBuffer DmaBuffer;
+struct DmaBuffer
+{
+    uint8_t *virt;
+    uint32_t *bus;
+    unsigned int pages;
+};
+
+// Bus addresses of the registers written by a control block chain
+typedef struct DmaRegs DmaRegs;
+struct DmaRegs
+{
+    uint32_t gpset;     // GPSET0, gates the output when there is no carrier
+    uint32_t gpclr;     // GPCLR0
+    uint32_t pwm_data;  // PWM DAT register of the carrier channel
+    uint32_t pwm_fifo;  // PWM FIFO, paces the chain at one word per tick
+};
+
+// Layout of the first control block slot, holding the words copied by the chain
+#define DMA_IR_WORD_ON    0   // carrier data or gpio mask
+#define DMA_IR_WORD_OFF   1   // 0 for the carrier data
+#define DMA_IR_WORD_PACE  2   // dummy word fed to the PWM FIFO
+
+unsigned int dma_ir_count(PulsePairs *pulsepairs, unsigned int tick);
+int dma_ir_build(DmaBuffer *buffer, DmaRegs *regs, PulsePairs *pulsepairs, unsigned int tick, int carrier, uint32_t on);
+uint32_t dma_bus_addr(DmaBuffer *buffer, void *virt);
+int dma_alloc(DmaBuffer *buffer, unsigned int size);
+void dma_free(DmaBuffer *buffer);
+int dma_ir_send(int gpio, PulsePairs *pulsepairs, float frequency, float dutycycle);
+
+#define DMA_IR_CHANNEL     14      // DMA lite channel, free on Raspbian kernels
+#define DMA_IR_TICK        5       // pacing tick in us
+#define DMA_IR_LITE_MAXLEN 65532   // max bytes moved by a lite channel control block, multiple of 4
+#define DMA_BUS_ALIAS      0x40000000  // L2 coherent alias of the SDRAM for the DMA on BCM2835
+
+#define DMA_IR_OK          0
+#define DMA_IR_NOT_MAPPED  1
+#define DMA_IR_MEM_FAIL    2
+#define DMA_IR_TIMEOUT     3
+#define DMA_IR_PWM_BUSY    4
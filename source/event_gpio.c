@@ -27,35 +27,88 @@ SOFTWARE.
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <sched.h>
 #include <sys/time.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/gpio.h>     // the character device backend needs the v2 uAPI of kernel 5.10, see GPIO_V2_GET_LINE_IOCTL
+#include "c_gpio.h"
 #include "event_gpio.h"
+#include "realtime.h"
 
 const char *stredge[4] = {"none", "rising", "falling", "both"};
 
 struct gpios
 {
     unsigned int gpio;
-    int value_fd;
+    int backend;                 // EVENT_BACKEND_SYSFS, EVENT_BACKEND_CDEV or EVENT_BACKEND_REGS
+    int value_fd;                // sysfs value file or line request fd
     int exported;
     int initial;
-    unsigned int bouncetime;
-    unsigned long long lastcall;
-    struct gpios *next;
+    unsigned int edge;
+    int debounce;                // DEBOUNCE_NONE, DEBOUNCE_IGNORE or DEBOUNCE_STABLE
+    unsigned long long bounce_ns;
+    unsigned long long lastcall; // ns, time of the last accepted edge
+    int accepted_level;          // DEBOUNCE_STABLE : level of the last accepted edge, -1 unknown
+    int pending;                 // DEBOUNCE_STABLE : an edge waits for the level to settle
+    int pending_level;
+    void (*recorder)(unsigned int gpio, unsigned long long timestamp, int level);
+    struct edge_record *edges;   // edge ring, written by poll_thread only
+    unsigned int edges_head;
+    unsigned int edges_tail;     // read by read_edges() only
+    unsigned int edges_lost;
 };
-struct gpios *gpio_list = NULL;
+struct gpios *gpio_table[54] = { NULL };   // indexed by gpio number, also carried in epoll_event.data
 
-// event callbacks
-struct callback
+// read_edges() calls inside the ring of each gpio. They take no lock : a reader counts itself in
+// before loading the gpio, and delete_gpio() clears the entry then waits for the count to drop
+// before freeing it, so a reader never stalls behind an event thread.
+unsigned int edge_readers[54] = { 0 };
+
+// Guards gpio_table, the gpios it points to except their edge rings, and callback_table. The
+// event threads hold it while they record edges, and release it to run the callbacks, so a
+// callback may add or remove edge detection and the Python callers never wait on a callback
+// holding the GIL.
+pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// event callbacks, one vector per gpio
+struct callbacks
 {
-    unsigned int gpio;
-    void (*func)(unsigned int gpio);
-    struct callback *next;
+    void (**funcs)(unsigned int gpio);
+    unsigned int count;
+    unsigned int capacity;
 };
-struct callback *callbacks = NULL;
+struct callbacks callback_table[54] = { { NULL, 0, 0 } };
 
 pthread_t threads;
 int event_occurred[54] = { 0 };
-int thread_running = 0;
+unsigned int event_batch = EVENT_BATCH_DEFAULT;   // ready gpios handled per wakeup
+struct event_stats event_counters = { 0, 0, 0 };
+
+// character device backend
+int event_backend = EVENT_BACKEND_SYSFS;
+int chip_fd = -1;
+
+// register poll backend
+uint64_t regpoll_mask = 0;       // gpios polled in GPEDS0/1
+unsigned int regpoll_interval = REGPOLL_DEFAULT_INTERVAL;
+int regpoll_running = 0;         // cleared by the thread under event_lock as it leaves
+int regpoll_joinable = 0;        // thread created and not joined yet
+pthread_t regpoll_threads;
+pthread_cond_t regpoll_cond;     // wakes the thread from its interval when a gpio is removed
+pthread_once_t regpoll_cond_ready = PTHREAD_ONCE_INIT;
+
+// DEBOUNCE_STABLE timer
+int debounce_timer = -1;
+unsigned int stable_count = 0;    // gpios in DEBOUNCE_STABLE mode
+#ifdef GPIO_V2_GET_LINE_IOCTL
+int cdev_line_request(int chip_fd, unsigned int gpio, unsigned int edge);
+int (*line_request)(int chip_fd, unsigned int gpio, unsigned int edge) = cdev_line_request;
+#endif
+int thread_running = 0;     // set by add_edge_detect() before the poll thread is created, the thread then runs for the process lifetime
 int epfd = -1;
 
 /************* /sys/class/gpio functions ************/
@@ -134,30 +187,71 @@ int open_value_file(unsigned int gpio)
     return fd;
 }
 
-/********* gpio list functions **********/
-struct gpios *get_gpio(unsigned int gpio)
+/************* /dev/gpiochipN functions ************/
+#ifdef GPIO_V2_GET_LINE_IOCTL
+// Request gpio as an input line reporting edge events, with CLOCK_MONOTONIC timestamps.
+// Return the non blocking line fd, -1 on error.
+int cdev_line_request(int chip_fd, unsigned int gpio, unsigned int edge)
 {
-    struct gpios *g = gpio_list;
-    while (g != NULL) {
-        if (g->gpio == gpio)
-            return g;
-        g = g->next;
-    }
-    return NULL;
+    struct gpio_v2_line_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = gpio;
+    req.num_lines = 1;
+    strncpy(req.consumer, "RPi.GPIO", sizeof(req.consumer) - 1);
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (edge & RISING_EDGE)
+        req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+    if (edge & FALLING_EDGE)
+        req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.event_buffer_size = CDEV_EVENT_BUFFER;
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1)
+        return -1;
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+    return req.fd;
 }
+#endif
 
-struct gpios *get_gpio_from_value_fd(int fd)
+// Select the backend used by the next add_edge_detect() calls, chip is the character device of
+// the gpios for EVENT_BACKEND_CDEV. Return -1 while edge detection is in use or if chip can not be opened,
+// -2 for EVENT_BACKEND_CDEV when built against kernel headers without the v2 gpio uAPI.
+int set_event_backend(int backend, const char *chip)
 {
-    struct gpios *g = gpio_list;
-    while (g != NULL) {
-        if (g->value_fd == fd)
-           return g;
-        g = g->next;
+    unsigned int i;
+    int fd = -1;
+
+#ifndef GPIO_V2_GET_LINE_IOCTL
+    if (backend == EVENT_BACKEND_CDEV)
+        return -2;
+#endif
+    pthread_mutex_lock(&event_lock);
+    for (i = 0; i < 54; i++) {
+        if (gpio_table[i] != NULL) {
+            pthread_mutex_unlock(&event_lock);
+            return -1;
+        }
     }
-    return NULL;
+    if (backend == EVENT_BACKEND_CDEV && (fd = open(chip, O_RDWR | O_CLOEXEC)) < 0) {
+        pthread_mutex_unlock(&event_lock);
+        return -1;
+    }
+    if (chip_fd != -1)
+        close(chip_fd);
+    chip_fd = fd;
+    event_backend = backend;
+    pthread_mutex_unlock(&event_lock);
+    return 0;
+}
+
+/********* gpio table functions **********/
+struct gpios *get_gpio(unsigned int gpio)
+{
+    if (gpio >= 54)
+        return NULL;
+    return gpio_table[gpio];
 }
 
-struct gpios *new_gpio(unsigned int gpio)
+struct gpios *new_gpio(unsigned int gpio, unsigned int edge)
 {
     struct gpios *new_gpio;
 
@@ -166,172 +260,607 @@ struct gpios *new_gpio(unsigned int gpio)
         return NULL;  // out of memory
 
     new_gpio->gpio = gpio;
+    new_gpio->edges = malloc(sizeof(struct edge_record) * EDGE_RING_SIZE);
+    if (new_gpio->edges == NULL) {
+        free(new_gpio);
+        return NULL;  // out of memory
+    }
+    new_gpio->edges_head = new_gpio->edges_tail = new_gpio->edges_lost = 0;
+    new_gpio->edge = edge;
+    new_gpio->debounce = DEBOUNCE_NONE;
+    new_gpio->bounce_ns = 0;
+    new_gpio->lastcall = 0;
+    new_gpio->accepted_level = -1;
+    new_gpio->pending = 0;
+    new_gpio->recorder = NULL;
+    new_gpio->backend = event_backend;
+
+    if (event_backend == EVENT_BACKEND_REGS) {
+        // edges latched by the GPIO block itself, no file at all
+        new_gpio->value_fd = -1;
+        new_gpio->exported = 0;
+        new_gpio->initial = 0;
+        set_rising_event(gpio, edge & RISING_EDGE);
+        set_falling_event(gpio, (edge & FALLING_EDGE) != 0);
+        pthread_mutex_lock(&event_lock);
+        __atomic_store_n(&gpio_table[gpio], new_gpio, __ATOMIC_RELEASE);
+        regpoll_mask |= 1ULL << gpio;
+        pthread_mutex_unlock(&event_lock);
+        return new_gpio;
+    }
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    if (event_backend == EVENT_BACKEND_CDEV) {
+        // the line request sets the direction and the edges, events carry no initial state
+        if ((new_gpio->value_fd = line_request(chip_fd, gpio, edge)) < 0) {
+            free(new_gpio->edges);
+            free(new_gpio);
+            return NULL;
+        }
+        new_gpio->exported = 0;
+        new_gpio->initial = 0;
+        pthread_mutex_lock(&event_lock);
+        __atomic_store_n(&gpio_table[gpio], new_gpio, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&event_lock);
+        return new_gpio;
+    }
+#endif
+
     if (gpio_export(gpio) != 0) {
+        free(new_gpio->edges);
         free(new_gpio);
         return NULL;
     }
     new_gpio->exported = 1;
 
     if (gpio_set_direction(gpio,1) != 0) { // 1==input
+        free(new_gpio->edges);
         free(new_gpio);
         return NULL;
     }
 
     if ((new_gpio->value_fd = open_value_file(gpio)) == -1) {
         gpio_unexport(gpio);
+        free(new_gpio->edges);
         free(new_gpio);
         return NULL;
     }
 
     new_gpio->initial = 1;
-    new_gpio->bouncetime = 0;
-    new_gpio->lastcall = 0;
-
-    if (gpio_list == NULL) {
-        new_gpio->next = NULL;
-    } else {
-        new_gpio->next = gpio_list;
-    }
-    gpio_list = new_gpio;
+    pthread_mutex_lock(&event_lock);
+    __atomic_store_n(&gpio_table[gpio], new_gpio, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&event_lock);
     return new_gpio;
 }
 
+// Called with event_lock held
 void delete_gpio(unsigned int gpio)
 {
-    struct gpios *g = gpio_list;
-    struct gpios *temp;
-    struct gpios *prev = NULL;
-
-    while (g != NULL) {
-        if (g->gpio == gpio) {
-            if (prev == NULL)
-                gpio_list = g->next;
-            else
-                prev->next = g->next;
-            temp = g;
-            g = g->next;
-            free(temp);
-        } else {
-            prev = g;
-            g = g->next;
+    struct gpios *g = get_gpio(gpio);
+
+    if (g == NULL)
+        return;
+    __atomic_store_n(&gpio_table[gpio], NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&edge_readers[gpio], __ATOMIC_SEQ_CST))
+        sched_yield();      // a read_edges() still copies from the ring
+    free(g->edges);
+    free(g);
+}
+
+/******* callback table functions ********/
+int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
+{
+    struct callbacks *cbs;
+    void (**funcs)(unsigned int gpio);
+
+    if (gpio >= 54)
+        return -1;
+    pthread_mutex_lock(&event_lock);
+    cbs = &callback_table[gpio];
+    if (cbs->count == EVENT_CALLBACKS_MAX) {
+        pthread_mutex_unlock(&event_lock);
+        return -1;
+    }
+    if (cbs->count == cbs->capacity) {
+        funcs = realloc(cbs->funcs, sizeof(*funcs) * (cbs->capacity ? cbs->capacity * 2 : 4));
+        if (funcs == NULL) {
+            pthread_mutex_unlock(&event_lock);
+            return -1;  // out of memory
         }
+        cbs->funcs = funcs;
+        cbs->capacity = cbs->capacity ? cbs->capacity * 2 : 4;
     }
+    cbs->funcs[cbs->count++] = func;
+    pthread_mutex_unlock(&event_lock);
+    return 0;
 }
 
-/******* callback list functions ********/
-int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio))
+// Run the callbacks of gpio on a copy of its vector taken under event_lock, called without it
+void run_callbacks(unsigned int gpio)
 {
-    struct callback *cb = callbacks;
-    struct callback *new_cb;
+    void (*funcs[EVENT_CALLBACKS_MAX])(unsigned int gpio);
+    unsigned int i, count;
 
-    new_cb = malloc(sizeof(struct callback));
-    if (new_cb == 0)
-        return -1;  // out of memory
+    pthread_mutex_lock(&event_lock);
+    count = callback_table[gpio].count;
+    for (i = 0; i < count; i++)
+        funcs[i] = callback_table[gpio].funcs[i];
+    pthread_mutex_unlock(&event_lock);
 
-    new_cb->gpio = gpio;
-    new_cb->func = func;
-    new_cb->next = NULL;
+    for (i = 0; i < count; i++)
+        funcs[i](gpio);
+}
 
-    if (callbacks == NULL) {
-        // start new list
-        callbacks = new_cb;
-    } else {
-        // add to end of list
-        while (cb->next != NULL)
-            cb = cb->next;
-        cb->next = new_cb;
+// Run the callbacks of the edges accepted by an event thread once it released event_lock
+static void dispatch_accepted(unsigned int *accepted)
+{
+    unsigned int gpio;
+
+    for (gpio = 0; gpio < 54; gpio++) {
+        while (accepted[gpio]) {
+            accepted[gpio]--;
+            run_callbacks(gpio);
+        }
     }
+}
+
+// Called with event_lock held
+void remove_callbacks(unsigned int gpio)
+{
+    struct callbacks *cbs = &callback_table[gpio];
+
+    cbs->count = 0;
+    cbs->capacity = 0;
+    free(cbs->funcs);
+    cbs->funcs = NULL;
+}
+
+/******* edge recorder functions ********/
+// Monotonic time in ns, the time base of the edge rings
+unsigned long long edge_timestamp_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Same time base in us, given to the edge recorders
+unsigned long long edge_timestamp(void)
+{
+    return edge_timestamp_ns() / 1000;
+}
+
+// Single producer / single consumer ring : poll_thread only moves head, read_edges() only moves
+// tail, each publishes its index with a release store after touching the records.
+static void push_edge(struct gpios *g, unsigned long long timestamp, int level)
+{
+    unsigned int head = g->edges_head;
+
+    if (head - __atomic_load_n(&g->edges_tail, __ATOMIC_ACQUIRE) >= EDGE_RING_SIZE) {
+        __atomic_add_fetch(&g->edges_lost, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    g->edges[head & (EDGE_RING_SIZE - 1)].timestamp = timestamp;
+    g->edges[head & (EDGE_RING_SIZE - 1)].level = level;
+    __atomic_store_n(&g->edges_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Copy up to max edges recorded on gpio into records, oldest first, and set *lost to the
+// number of edges dropped on a full ring since the last call when lost is not NULL.
+// Takes no lock, see edge_readers. Must be called from one thread at a time per gpio.
+// Return the number of edges, -1 if gpio has no edge detection.
+int read_edges(unsigned int gpio, struct edge_record *records, unsigned int max, unsigned int *lost)
+{
+    struct gpios *g;
+    unsigned int head, tail, n = 0;
+
+    if (gpio >= 54)
+        return -1;
+    __atomic_add_fetch(&edge_readers[gpio], 1, __ATOMIC_SEQ_CST);
+    if ((g = __atomic_load_n(&gpio_table[gpio], __ATOMIC_SEQ_CST)) == NULL) {
+        __atomic_sub_fetch(&edge_readers[gpio], 1, __ATOMIC_RELEASE);
+        return -1;
+    }
+    tail = g->edges_tail;
+    head = __atomic_load_n(&g->edges_head, __ATOMIC_ACQUIRE);
+    while (tail != head && n < max)
+        records[n++] = g->edges[tail++ & (EDGE_RING_SIZE - 1)];
+    __atomic_store_n(&g->edges_tail, tail, __ATOMIC_RELEASE);
+    if (lost != NULL)
+        *lost = __atomic_exchange_n(&g->edges_lost, 0, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&edge_readers[gpio], 1, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Set the function receiving every edge of gpio with its time and new level, ahead of the
+// bouncetime filter and the callbacks. func NULL removes it. Return -1 if gpio has no edge detection.
+int set_edge_recorder(unsigned int gpio, void (*func)(unsigned int gpio, unsigned long long timestamp, int level))
+{
+    struct gpios *g;
+
+    pthread_mutex_lock(&event_lock);
+    if ((g = get_gpio(gpio)) == NULL) {
+        pthread_mutex_unlock(&event_lock);
+        return -1;
+    }
+    g->recorder = func;
+    pthread_mutex_unlock(&event_lock);
     return 0;
 }
 
-void run_callbacks(unsigned int gpio)
+// Return 1 if called from the thread running the edge callbacks
+int event_thread_current(void)
+{
+    return (thread_running && pthread_equal(pthread_self(), threads))
+        || (regpoll_running && pthread_equal(pthread_self(), regpoll_threads));
+}
+
+/******* poll thread batching ********/
+// Set the number of ready gpios handled per wakeup of the poll thread, 1 to EVENT_BATCH_MAX.
+// Return -1 if size is out of range.
+int set_event_batch(unsigned int size)
 {
-    struct callback *cb = callbacks;
-    while (cb != NULL)
-    {
-        if (cb->gpio == gpio)
-            cb->func(cb->gpio);
-        cb = cb->next;
+    if (size < 1 || size > EVENT_BATCH_MAX)
+        return -1;
+    event_batch = size;
+    return 0;
+}
+
+// Copy the poll thread counters into stats, and reset them if reset is set
+void get_event_stats(struct event_stats *stats, int reset)
+{
+    *stats = event_counters;
+    if (reset)
+        memset(&event_counters, 0, sizeof(event_counters));
+}
+
+/******* debounce functions ********/
+// Set how edges of gpio are filtered before event_detected() and the callbacks, time in us.
+// DEBOUNCE_IGNORE drops the edges within time after the last accepted one, DEBOUNCE_STABLE
+// accepts an edge once the level did not change for time.
+// return values:
+// 0 - Success
+// -1 - gpio has no edge detection
+// -2 - DEBOUNCE_STABLE timer not created, errno set
+// -3 - DEBOUNCE_STABLE timer not added to epoll, errno set
+int set_debounce(unsigned int gpio, int mode, unsigned int time)
+{
+    struct gpios *g;
+    struct epoll_event ev;
+    int was_stable, err;
+
+    pthread_mutex_lock(&event_lock);
+    if ((g = get_gpio(gpio)) == NULL) {
+        pthread_mutex_unlock(&event_lock);
+        return -1;
     }
+    if (mode == DEBOUNCE_STABLE && debounce_timer == -1) {
+        // wakes the poll thread when a level has settled
+        if ((debounce_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+            pthread_mutex_unlock(&event_lock);
+            return -2;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = DEBOUNCE_TIMER_ID;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, debounce_timer, &ev) == -1) {
+            err = errno;
+            close(debounce_timer);
+            debounce_timer = -1;
+            pthread_mutex_unlock(&event_lock);
+            errno = err;
+            return -3;
+        }
+    }
+    was_stable = g->debounce == DEBOUNCE_STABLE;
+    g->debounce = time ? mode : DEBOUNCE_NONE;
+    g->bounce_ns = (unsigned long long)time * 1000;
+    g->pending = 0;
+    g->accepted_level = -1;
+    stable_count += (g->debounce == DEBOUNCE_STABLE) - was_stable;
+    pthread_mutex_unlock(&event_lock);
+    return 0;
 }
 
-void remove_callbacks(unsigned int gpio)
+// The callbacks run later, from dispatch_accepted()
+static void accept_edge(struct gpios *g, unsigned int *accepted)
+{
+    event_occurred[g->gpio] = 1;
+    accepted[g->gpio]++;
+}
+
+// Accept the pending edges whose level has settled at now, and arm the timer for the next one.
+// Called with event_lock held.
+static void settle_edges(unsigned long long now, unsigned int *accepted)
 {
-    struct callback *cb = callbacks;
-    struct callback *temp;
-    struct callback *prev = NULL;
-
-    while (cb != NULL)
-    {
-        if (cb->gpio == gpio)
-        {
-            if (prev == NULL)
-                callbacks = cb->next;
-            else
-                prev->next = cb->next;
-            temp = cb;
-            cb = cb->next;
-            free(temp);
-        } else {
-            prev = cb;
-            cb = cb->next;
+    struct itimerspec its;
+    unsigned long long next = 0, deadline;
+    unsigned int i;
+    struct gpios *g;
+
+    for (i = 0; i < 54; i++) {
+        if ((g = gpio_table[i]) == NULL || !g->pending)
+            continue;
+        deadline = g->lastcall + g->bounce_ns;
+        if (now >= deadline) {
+            g->pending = 0;
+            // with both edges a bounce back to the accepted level is no edge at all
+            if (g->edge != BOTH_EDGE || g->pending_level != g->accepted_level) {
+                g->accepted_level = g->pending_level;
+                accept_edge(g, accepted);
+            }
+        } else if (next == 0 || deadline < next) {
+            next = deadline;
         }
     }
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000000000ULL;
+    its.it_value.tv_nsec = next % 1000000000ULL;
+    timerfd_settime(debounce_timer, TFD_TIMER_ABSTIME, &its, NULL);   // 0 disarms
+}
+
+// Record an edge and count it in accepted when it passes the debounce, timestamp in ns.
+// Called with event_lock held.
+static void handle_edge(struct gpios *g, unsigned long long timestamp, int level, unsigned int *accepted)
+{
+    push_edge(g, timestamp, level);
+    if (g->recorder != NULL)
+        g->recorder(g->gpio, timestamp / 1000, level);
+
+    switch (g->debounce) {
+    case DEBOUNCE_STABLE:
+        // each edge restarts the settling time, lastcall is the last edge seen
+        g->pending = 1;
+        g->pending_level = level;
+        g->lastcall = timestamp;
+        break;
+    case DEBOUNCE_IGNORE:
+        if (g->lastcall != 0 && timestamp - g->lastcall <= g->bounce_ns && timestamp >= g->lastcall)
+            break;
+        g->lastcall = timestamp;
+        accept_edge(g, accepted);
+        break;
+    default:
+        accept_edge(g, accepted);
+    }
 }
 
+#ifdef GPIO_V2_GET_LINE_IOCTL
+// Read every pending line event of a character device gpio, with its kernel timestamp.
+// Return -1 on a read error.
+static int read_line_events(struct gpios *g, unsigned int *accepted)
+{
+    struct gpio_v2_line_event events[CDEV_EVENT_BATCH];
+    ssize_t size;
+    int i, n;
+
+    do {
+        if ((size = read(g->value_fd, events, sizeof(events))) < 0)
+            return errno == EAGAIN ? 0 : -1;
+        n = size / sizeof(struct gpio_v2_line_event);
+        for (i = 0; i < n; i++)
+            handle_edge(g, events[i].timestamp_ns, events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE, accepted);
+    } while (n == CDEV_EVENT_BATCH);   // edge triggered epoll, drain the line
+    return 0;
+}
+#endif
+
 void *poll_thread(void *threadarg)
 {
-    struct epoll_event events;
-    char buf;
-    struct timeval tv_timenow;
-    unsigned long long timenow;
+    struct epoll_event events[EVENT_BATCH_MAX];
+    char buf[EVENT_BATCH_MAX];
+    unsigned int accepted[54] = { 0 };
+    unsigned long long timestamp;
+    uint64_t expirations;
     struct gpios *g;
-    int n;
+    int i, n;
 
-    thread_running = 1;
+    realtime_thread_enter();
     while (thread_running) {
-        if ((n = epoll_wait(epfd, &events, 1, -1)) == -1) {
+        if ((n = epoll_wait(epfd, events, event_batch, -1)) == -1) {
+            if (errno == EINTR)
+                continue;
             thread_running = 0;
+            realtime_thread_leave();
             pthread_exit(NULL);
         }
-        if (n > 0) {
-            lseek(events.data.fd, 0, SEEK_SET);
-            if (read(events.data.fd, &buf, 1) != 1) {
+        if (n <= 0)
+            continue;
+        timestamp = edge_timestamp_ns();    // one time for the whole batch, as close to the wake up as possible
+        pthread_mutex_lock(&event_lock);
+        event_counters.wakeups++;
+        event_counters.events += n;
+        if ((unsigned int)n > event_counters.max_batch)
+            event_counters.max_batch = n;
+
+        // read every sysfs level first, so the batch is seen at the same time
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u32 == DEBOUNCE_TIMER_ID) {
+                read(debounce_timer, &expirations, sizeof(expirations));
+                continue;
+            }
+            if ((g = gpio_table[events[i].data.u32]) == NULL || g->backend != EVENT_BACKEND_SYSFS)
+                continue;     // removed while the event was pending, or line events
+            if (pread(g->value_fd, &buf[i], 1, 0) != 1) {
+                pthread_mutex_unlock(&event_lock);
                 thread_running = 0;
+                realtime_thread_leave();
                 pthread_exit(NULL);
             }
-            g = get_gpio_from_value_fd(events.data.fd);
+        }
+
+        // then record and dispatch
+        for (i = 0; i < n; i++) {
+            if (events[i].data.u32 == DEBOUNCE_TIMER_ID || (g = gpio_table[events[i].data.u32]) == NULL)
+                continue;
+#ifdef GPIO_V2_GET_LINE_IOCTL
+            if (g->backend == EVENT_BACKEND_CDEV) {
+                if (read_line_events(g, accepted) != 0) {
+                    pthread_mutex_unlock(&event_lock);
+                    thread_running = 0;
+                    realtime_thread_leave();
+                    pthread_exit(NULL);
+                }
+                continue;
+            }
+#endif
             if (g->initial) {     // ignore first epoll trigger
                 g->initial = 0;
             } else {
-                gettimeofday(&tv_timenow, NULL);
-                timenow = tv_timenow.tv_sec*1E6 + tv_timenow.tv_usec;
-                if (g->bouncetime == 0 || timenow - g->lastcall > g->bouncetime*1000 || g->lastcall == 0 || g->lastcall > timenow) {
-                    g->lastcall = timenow;
-                    event_occurred[g->gpio] = 1;
-                    run_callbacks(g->gpio);
-                }
+                handle_edge(g, timestamp, buf[i] == '1', accepted);
             }
         }
+        if (stable_count)
+            settle_edges(edge_timestamp_ns(), accepted);
+        pthread_mutex_unlock(&event_lock);
+        dispatch_accepted(accepted);
     }
     thread_running = 0;
+    realtime_thread_leave();
+    pthread_exit(NULL);
+}
+
+/******* register poll functions ********/
+// Set the time in us the register poll thread sleeps between two reads of GPEDS, 0 spins
+void set_regpoll_interval(unsigned int interval)
+{
+    regpoll_interval = interval;
+}
+
+// Read the edges latched on all gpios, clear them with one write and record them with their
+// levels. Called with event_lock held. Return the number of edges.
+static int regpoll_scan(unsigned int *accepted)
+{
+    uint64_t mask, levels;
+    unsigned long long timestamp;
+    unsigned int gpio;
+    struct gpios *g;
+    int n = 0;
+
+    if ((mask = event_mask() & regpoll_mask) == 0)
+        return 0;
+    timestamp = edge_timestamp_ns();
+    clear_event_mask(mask);
+    levels = level_mask();
+    while (mask) {
+        gpio = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        if ((g = gpio_table[gpio]) != NULL) {
+            handle_edge(g, timestamp, (levels >> gpio) & 1, accepted);
+            n++;
+        }
+    }
+    event_counters.wakeups++;
+    event_counters.events += n;
+    if ((unsigned int)n > event_counters.max_batch)
+        event_counters.max_batch = n;
+    return n;
+}
+
+// One register poll : record the latched edges and run their callbacks. Return the number of edges.
+int regpoll_once(void)
+{
+    unsigned int accepted[54] = { 0 };
+    int n;
+
+    pthread_mutex_lock(&event_lock);
+    n = regpoll_scan(accepted);
+    pthread_mutex_unlock(&event_lock);
+    dispatch_accepted(accepted);
+    return n;
+}
+
+static void regpoll_cond_init(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&regpoll_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Polls until the last gpio is removed, the mask is only read under event_lock so an add never
+// finds regpoll_running set by a thread about to leave
+void *regpoll_thread(void *threadarg)
+{
+    unsigned int accepted[54] = { 0 };
+    struct timespec ts;
+
+    realtime_thread_enter();
+    pthread_mutex_lock(&event_lock);
+    while (regpoll_mask) {
+        if (regpoll_interval) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += regpoll_interval / 1000000;
+            ts.tv_nsec += (regpoll_interval % 1000000) * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_nsec -= 1000000000;
+                ts.tv_sec++;
+            }
+            pthread_cond_timedwait(&regpoll_cond, &event_lock, &ts);
+            if (!regpoll_mask)
+                break;
+        }
+        regpoll_scan(accepted);
+        if (stable_count)
+            settle_edges(edge_timestamp_ns(), accepted);
+        pthread_mutex_unlock(&event_lock);
+        dispatch_accepted(accepted);
+        pthread_mutex_lock(&event_lock);
+    }
+    regpoll_running = 0;
+    pthread_mutex_unlock(&event_lock);
+    realtime_thread_leave();
     pthread_exit(NULL);
 }
 
 void remove_edge_detect(unsigned int gpio)
 {
     struct epoll_event ev;
-    struct gpios *g = get_gpio(gpio);
+    struct gpios *g;
 
-    if (g == NULL)
+    pthread_mutex_lock(&event_lock);
+    if ((g = get_gpio(gpio)) == NULL) {
+        pthread_mutex_unlock(&event_lock);
         return;
+    }
 
     // delete epoll of fd
-    epoll_ctl(epfd, EPOLL_CTL_DEL, g->value_fd, &ev);
+    if (g->value_fd != -1)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, g->value_fd, &ev);
 
     // delete callbacks for gpio
     remove_callbacks(gpio);
 
+    if (g->debounce == DEBOUNCE_STABLE)
+        stable_count--;
+
+    if (g->backend == EVENT_BACKEND_REGS) {
+        regpoll_mask &= ~(1ULL << gpio);    // the thread stops with the last gpio
+        set_rising_event(gpio, 0);
+        set_falling_event(gpio, 0);
+        event_occurred[gpio] = 0;
+        delete_gpio(gpio);
+        if (regpoll_joinable)
+            pthread_cond_signal(&regpoll_cond);
+        pthread_mutex_unlock(&event_lock);
+        // wait for the thread to leave, unless removed from one of its callbacks : the next add joins it then
+        if (regpoll_mask == 0 && regpoll_joinable && !pthread_equal(pthread_self(), regpoll_threads)) {
+            pthread_join(regpoll_threads, NULL);
+            regpoll_joinable = 0;
+        }
+        return;
+    }
+
+    if (g->backend == EVENT_BACKEND_CDEV) {
+        close(g->value_fd);     // releases the line
+        event_occurred[gpio] = 0;
+        delete_gpio(gpio);
+        pthread_mutex_unlock(&event_lock);
+        return;
+    }
+
     // btc fixme - check return result??
     gpio_set_edge(gpio, NO_EDGE);
 
@@ -343,6 +872,7 @@ void remove_edge_detect(unsigned int gpio)
     event_occurred[gpio] = 0;
 
     delete_gpio(gpio);
+    pthread_mutex_unlock(&event_lock);
 }
 
 int event_detected(unsigned int gpio)
@@ -358,11 +888,12 @@ int event_detected(unsigned int gpio)
 void event_cleanup(unsigned int gpio)
 // gpio of -666 means clean every channel used
 {
-    while (gpio_list != NULL) {
-        if ((gpio == -666) || (gpio_list->gpio == gpio))
-            remove_edge_detect(gpio_list->gpio);
-    }
-    thread_running = 0;
+    unsigned int i;
+
+    // the poll thread keeps waiting on epfd, the only producer of the edge rings for the next gpios
+    for (i = 0; i < 54; i++)
+        if ((gpio == -666) || (i == gpio))
+            remove_edge_detect(i);
 }
 
 void event_cleanup_all(void)
@@ -372,13 +903,20 @@ void event_cleanup_all(void)
 
 int gpio_event_added(unsigned int gpio)
 {
-    struct gpios *g = gpio_list;
-    while (g != NULL) {
-        if (g->gpio == gpio)
-            return 1;
-        g = g->next;
-    }
-    return 0;
+    return get_gpio(gpio) != NULL;
+}
+
+// Return the edges detected on gpio, -1 if it has no edge detection
+int gpio_event_edge(unsigned int gpio)
+{
+    struct gpios *g;
+    int edge = -1;
+
+    pthread_mutex_lock(&event_lock);
+    if ((g = get_gpio(gpio)) != NULL)
+        edge = g->edge;
+    pthread_mutex_unlock(&event_lock);
+    return edge;
 }
 
 int add_edge_detect(unsigned int gpio, unsigned int edge, unsigned int bouncetime)
@@ -387,7 +925,6 @@ int add_edge_detect(unsigned int gpio, unsigned int edge, unsigned int bouncetim
 // 1 - Edge detection already added
 // 2 - Other error
 {
-    pthread_t threads;
     struct epoll_event ev;
     long t = 0;
     struct gpios *g;
@@ -400,26 +937,55 @@ int add_edge_detect(unsigned int gpio, unsigned int edge, unsigned int bouncetim
     if ((epfd == -1) && ((epfd = epoll_create(1)) == -1))
         return 2;
 
-    if ((g = new_gpio(gpio)) == NULL)
+    if ((g = new_gpio(gpio, edge)) == NULL)
         return 2;
     
-    gpio_set_edge(gpio, edge);
-    g->bouncetime = bouncetime;
+    if (g->backend == EVENT_BACKEND_SYSFS)
+        gpio_set_edge(gpio, edge);
+    if (bouncetime) {
+        g->debounce = DEBOUNCE_IGNORE;
+        g->bounce_ns = (unsigned long long)bouncetime * 1000000;
+    }
+
+    if (g->backend == EVENT_BACKEND_REGS) {
+        // start register poll thread if it is not already running
+        pthread_mutex_lock(&event_lock);
+        if (!regpoll_running) {
+            if (regpoll_joinable) {     // left after its last gpio was removed from a callback
+                pthread_join(regpoll_threads, NULL);
+                regpoll_joinable = 0;
+            }
+            pthread_once(&regpoll_cond_ready, regpoll_cond_init);
+            regpoll_running = 1;
+            if (pthread_create(&regpoll_threads, NULL, regpoll_thread, (void *)t) != 0) {
+                regpoll_running = 0;
+                pthread_mutex_unlock(&event_lock);
+                remove_edge_detect(gpio);
+                return 2;
+            }
+            regpoll_joinable = 1;
+        }
+        pthread_mutex_unlock(&event_lock);
+        return 0;
+    }
 
     // add to epoll fd
     ev.events = EPOLLIN | EPOLLET | EPOLLPRI;
-    ev.data.fd = g->value_fd;
+    ev.data.u32 = gpio;
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, g->value_fd, &ev) == -1) {
         remove_edge_detect(gpio);
         return 2;
     }
 
-    // start poll thread if it is not already running
+    // start poll thread if it is not already running, flagged first so it is never started twice
     if (!thread_running) {
+        thread_running = 1;
         if (pthread_create(&threads, NULL, poll_thread, (void *)t) != 0) {
+           thread_running = 0;
            remove_edge_detect(gpio);
            return 2;
         }
+        pthread_detach(threads);
     }
     return 0;
 }
@@ -486,3 +1052,244 @@ int blocking_wait_for_edge(unsigned int gpio, unsigned int edge)
     gpio_unexport(gpio);
     return 0;
 }
+
+#ifdef EVENT_GPIO_TEST
+// Runs the character device backend against a fake line fd (a pipe fed with gpio_v2_line_event records)
+// and the register poll backend against a simulated GPIO register page.
+// gcc event_gpio.c c_gpio.c bcm2835.c realtime.c trace.c -lpthread -D EVENT_GPIO_TEST
+// ./a.out
+
+static int fake_calls = 0;
+
+static void fake_callback(unsigned int gpio)
+{
+    fake_calls++;
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+static int fake_line_write = -1;
+
+static int fake_line_request(int chip_fd, unsigned int gpio, unsigned int edge)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+        return -1;
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fake_line_write = fds[1];
+    return fds[0];
+}
+
+// Send one line event per offset in us from start, levels alternating from level
+static void fake_edges(unsigned long long start, const unsigned int *offsets, unsigned int count, int level)
+{
+    struct gpio_v2_line_event event;
+    unsigned int i;
+
+    memset(&event, 0, sizeof(event));
+    for (i = 0; i < count; i++) {
+        event.timestamp_ns = start + offsets[i] * 1000ULL;
+        event.id = (level ^ (i % 2)) ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+        write(fake_line_write, &event, sizeof(event));
+    }
+}
+
+// Debounce modes on kernel timestamps, return the number of errors
+static int test_debounce(void)
+{
+    static const unsigned int burst[] = { 0, 100, 250 };
+    static const unsigned int spaced[] = { 0, 500, 1500 };
+    int errors = 0;
+
+    // a burst settles into one edge, after the level is stable
+    set_debounce(17, DEBOUNCE_STABLE, 5000);
+    fake_calls = 0;
+    fake_edges(edge_timestamp_ns(), burst, 3, 1);
+    usleep(2000);
+    if (fake_calls != 0)
+        errors++, printf("FAIL : stable edge accepted before it settled\n");
+    usleep(20000);
+    if (fake_calls != 1)
+        errors++, printf("FAIL : %d stable edges, expected 1\n", fake_calls);
+
+    // a glitch back to the accepted level is no edge
+    fake_calls = 0;
+    fake_edges(edge_timestamp_ns(), burst, 2, 0);
+    usleep(20000);
+    if (fake_calls != 0)
+        errors++, printf("FAIL : glitch accepted\n");
+
+    // edges within the window after the last accepted one are dropped
+    set_debounce(17, DEBOUNCE_IGNORE, 1000);
+    fake_calls = 0;
+    fake_edges(edge_timestamp_ns(), spaced, 3, 1);
+    usleep(10000);
+    if (fake_calls != 2)
+        errors++, printf("FAIL : %d edges out of the ignore window, expected 2\n", fake_calls);
+    set_debounce(17, DEBOUNCE_NONE, 0);
+    return errors;
+}
+
+// Character device backend on a fake line, return the number of errors
+static int test_cdev(void)
+{
+    struct gpio_v2_line_event events[200];
+    struct edge_record records[256];
+    unsigned int i, total = 0;
+    pthread_t first;
+    int n, errors = 0;
+
+    line_request = fake_line_request;
+    if (set_event_backend(EVENT_BACKEND_CDEV, "/dev/null") != 0 || add_edge_detect(17, BOTH_EDGE, 0) != 0) {
+        printf("FAIL : fake line not requested\n");
+        return 1;
+    }
+    add_edge_callback(17, fake_callback);
+    if (set_event_backend(EVENT_BACKEND_SYSFS, NULL) != -1)
+        errors++, printf("FAIL : backend changed while in use\n");
+
+    // more events than one read, all sent at once
+    memset(events, 0, sizeof(events));
+    for (i = 0; i < 200; i++) {
+        events[i].timestamp_ns = 1000000ULL + i * 562500ULL;
+        events[i].id = i % 2 ? GPIO_V2_LINE_EVENT_FALLING_EDGE : GPIO_V2_LINE_EVENT_RISING_EDGE;
+        events[i].offset = 17;
+        events[i].line_seqno = i + 1;
+    }
+    write(fake_line_write, events, sizeof(events));
+    usleep(50000);
+
+    while ((n = read_edges(17, records, 64, NULL)) > 0) {
+        for (i = 0; i < (unsigned int)n; i++, total++) {
+            if (records[i].timestamp != events[total].timestamp_ns || records[i].level != (total % 2 ? 0 : 1))
+                errors++, printf("FAIL : edge %u %llu %d\n", total, records[i].timestamp, records[i].level);
+        }
+    }
+    if (total != 200)
+        errors++, printf("FAIL : %u edges read, expected 200\n", total);
+    if (fake_calls != 200)
+        errors++, printf("FAIL : %d callbacks, expected 200\n", fake_calls);
+    errors += test_debounce();
+
+    remove_edge_detect(17);
+    if (gpio_event_added(17))
+        errors++, printf("FAIL : line not removed\n");
+    close(fake_line_write);
+
+    // the poll thread outlives a cleanup, a new gpio gets no second producer
+    first = threads;
+    event_cleanup_all();
+    if (!thread_running || add_edge_detect(17, BOTH_EDGE, 0) != 0 || !pthread_equal(first, threads))
+        errors++, printf("FAIL : poll thread restarted after cleanup\n");
+    remove_edge_detect(17);
+    close(fake_line_write);
+    return errors;
+}
+#endif
+
+static int reader_stop = 0;
+
+static void *edge_reader(void *arg)
+{
+    struct edge_record records[4];
+
+    while (!__atomic_load_n(&reader_stop, __ATOMIC_RELAXED))
+        read_edges(4, records, 4, NULL);
+    return NULL;
+}
+
+// Register poll on a simulated page, GPEDS write 1 to clear is checked then emulated.
+// Return the number of errors.
+static int test_regpoll(void)
+{
+    static uint32_t page[1024];
+    struct edge_record records[4];
+    pthread_t reader;
+    int i, saved_epfd, errors = 0;
+
+    setup_map(page);
+    set_regpoll_interval(10000000);    // keep the thread asleep, the test polls itself
+    if (set_event_backend(EVENT_BACKEND_REGS, NULL) != 0 || add_edge_detect(4, BOTH_EDGE, 0) != 0 || add_edge_detect(40, RISING_EDGE, 0) != 0) {
+        printf("FAIL : register poll gpios not added\n");
+        return 1;
+    }
+    add_edge_callback(4, fake_callback);
+    add_edge_callback(40, fake_callback);
+    if (page[0x4c/4] != (1 << 4) || page[0x58/4] != (1 << 4) || page[0x50/4] != (1 << 8) || page[0x5c/4] != 0)
+        errors++, printf("FAIL : GPREN/GPFEN %08X %08X %08X %08X\n", page[0x4c/4], page[0x58/4], page[0x50/4], page[0x5c/4]);
+
+    page[0x40/4] = page[0x44/4] = 0;       // emulate the clears done while enabling
+    fake_calls = 0;
+    if (regpoll_once() != 0)
+        errors++, printf("FAIL : edge without GPEDS bit\n");
+    page[0x40/4] = (1 << 4) | (1 << 5);    // gpio 5 has no edge detection
+    page[0x44/4] = 1 << 8;
+    page[0x34/4] = 1 << 4;                 // GPLEV0
+    if (regpoll_once() != 2 || fake_calls != 2)
+        errors++, printf("FAIL : %d callbacks for 2 latched edges\n", fake_calls);
+    if (page[0x40/4] != (1 << 4) || page[0x44/4] != (1 << 8))
+        errors++, printf("FAIL : GPEDS cleared with %08X %08X\n", page[0x40/4], page[0x44/4]);
+    page[0x40/4] = page[0x44/4] = 0;
+    if (read_edges(4, records, 4, NULL) != 1 || records[0].level != 1)
+        errors++, printf("FAIL : gpio 4 edge\n");
+    if (read_edges(40, records, 4, NULL) != 1 || records[0].level != 0)
+        errors++, printf("FAIL : gpio 40 edge\n");
+    // a reader never waits for the event threads
+    pthread_mutex_lock(&event_lock);
+    if (read_edges(4, records, 4, NULL) != 0)
+        errors++, printf("FAIL : ring not empty\n");
+    pthread_mutex_unlock(&event_lock);
+
+    // a timer that can not be watched is told apart from a gpio without edge detection
+    if (debounce_timer != -1) {
+        close(debounce_timer);
+        debounce_timer = -1;
+    }
+    saved_epfd = epfd;
+    epfd = -1;
+    if (set_debounce(4, DEBOUNCE_STABLE, 1000) != -3 || errno != EBADF || debounce_timer != -1)
+        errors++, printf("FAIL : debounce timer epoll failure not reported\n");
+    epfd = saved_epfd;
+    if (set_debounce(6, DEBOUNCE_STABLE, 1000) != -1)
+        errors++, printf("FAIL : debounce set without edge detection\n");
+
+    remove_edge_detect(4);
+    remove_edge_detect(40);
+    if (page[0x4c/4] || page[0x58/4] || page[0x50/4])
+        errors++, printf("FAIL : edge detection left enabled\n");
+
+    // the thread is joined with the last gpio, out of its interval, and a quick add starts a new one
+    if (regpoll_running || regpoll_joinable)
+        errors++, printf("FAIL : register poll thread not joined\n");
+    if (add_edge_detect(4, BOTH_EDGE, 0) != 0 || !regpoll_running)
+        errors++, printf("FAIL : register poll thread not restarted\n");
+    remove_edge_detect(4);
+
+    // the gpio is freed under a reader only once it left
+    pthread_create(&reader, NULL, edge_reader, NULL);
+    for (i = 0; i < 1000; i++) {
+        add_edge_detect(4, BOTH_EDGE, 0);
+        remove_edge_detect(4);
+    }
+    __atomic_store_n(&reader_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(reader, NULL);
+    set_event_backend(EVENT_BACKEND_SYSFS, NULL);
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    int errors = 0;
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    errors += test_cdev();
+#else
+    if (set_event_backend(EVENT_BACKEND_CDEV, "/dev/null") != -2)
+        errors++, printf("FAIL : character device backend selected without the v2 uAPI\n");
+#endif
+    errors += test_regpoll();
+
+    printf("%s : %d error(s)\n", errors ? "FAIL" : "OK", errors);
+    return errors ? 1 : 0;
+}
+#endif
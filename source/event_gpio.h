@@ -25,12 +25,57 @@ SOFTWARE.
 #define FALLING_EDGE 2
 #define BOTH_EDGE    3
 
+#define EDGE_RING_SIZE 4096   // edges kept per gpio, power of 2
+
+// edge seen by the event thread, timestamp in ns from edge_timestamp_ns()
+struct edge_record
+{
+    unsigned long long timestamp;
+    int level;
+};
+
+#define EVENT_BACKEND_SYSFS 0   // /sys/class/gpio value files
+#define EVENT_BACKEND_CDEV  1   // /dev/gpiochipN line requests, kernel timestamps
+#define EVENT_BACKEND_REGS  2   // GPEDS0/1 registers polled by a thread
+#define REGPOLL_DEFAULT_INTERVAL 10  // us between two register polls
+#define CDEV_EVENT_BUFFER   1024  // line events queued by the kernel
+#define CDEV_EVENT_BATCH    64    // line events read per read()
+
+#define DEBOUNCE_NONE       0
+#define DEBOUNCE_IGNORE     1   // ignore edges for a time after the last accepted one
+#define DEBOUNCE_STABLE     2   // accept an edge once the level is stable for a time
+#define DEBOUNCE_TIMER_ID   54  // epoll_event.data of the DEBOUNCE_STABLE timer
+
+#define EVENT_BATCH_DEFAULT 16
+#define EVENT_BATCH_MAX     55    // one event per gpio at most, and the debounce timer
+#define EVENT_CALLBACKS_MAX 16    // callbacks per gpio
+
+// poll thread counters
+struct event_stats
+{
+    unsigned long long wakeups;    // returns of epoll_wait with events
+    unsigned long long events;     // events handled
+    unsigned int max_batch;        // largest number of events in one wakeup
+};
+
 int add_edge_detect(unsigned int gpio, unsigned int edge, unsigned int bouncetime);
 void remove_edge_detect(unsigned int gpio);
 int add_edge_callback(unsigned int gpio, void (*func)(unsigned int gpio));
 int event_detected(unsigned int gpio);
 int gpio_event_added(unsigned int gpio);
+int gpio_event_edge(unsigned int gpio);
 int event_initialise(void);
 void event_cleanup(unsigned int gpio);
 void event_cleanup_all(void);
 int blocking_wait_for_edge(unsigned int gpio, unsigned int edge);
+unsigned long long edge_timestamp_ns(void);
+unsigned long long edge_timestamp(void);
+int read_edges(unsigned int gpio, struct edge_record *records, unsigned int max, unsigned int *lost);
+int set_edge_recorder(unsigned int gpio, void (*func)(unsigned int gpio, unsigned long long timestamp, int level));
+int event_thread_current(void);
+int set_event_batch(unsigned int size);
+int set_event_backend(int backend, const char *chip);
+int set_debounce(unsigned int gpio, int mode, unsigned int time);
+void set_regpoll_interval(unsigned int interval);
+int regpoll_once(void);
+void get_event_stats(struct event_stats *stats, int reset);
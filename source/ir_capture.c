@@ -0,0 +1,363 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "c_gpio.h"
+#include "event_gpio.h"
+#include "ir_capture.h"
+
+#define IR_CAPTURE_MASK (IR_CAPTURE_RINGSIZE - 1)
+
+// one lock for the table and the rings, edges come from a single thread
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static IrCapture *captures[54] = { NULL };
+
+// Edge recorder called by the event thread, only stores the edge
+static void record_edge(unsigned int gpio, unsigned long long timestamp, int level)
+{
+    IrCapture *cap;
+
+    pthread_mutex_lock(&capture_lock);
+    if ((cap = captures[gpio]) != NULL) {
+        if (cap->head - cap->tail < IR_CAPTURE_RINGSIZE) {
+            cap->ring[cap->head & IR_CAPTURE_MASK].timestamp = timestamp;
+            cap->ring[cap->head & IR_CAPTURE_MASK].level = level;
+            cap->head++;
+            pthread_cond_signal(&cap->edge);
+        } else {
+            cap->overruns++;
+        }
+    }
+    pthread_mutex_unlock(&capture_lock);
+}
+
+static IrCapture *new_capture(unsigned int gpio, unsigned int timeout)
+{
+    IrCapture *cap;
+    pthread_condattr_t attr;
+
+    if ((cap = malloc(sizeof(IrCapture))) == NULL)
+        return NULL;
+    cap->gpio = gpio;
+    cap->timeout = timeout;
+    cap->owned = 0;
+    cap->head = cap->tail = 0;
+    cap->overruns = 0;
+    cap->readers = 0;
+    cap->stopped = 0;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);  // same time base as the edges
+    pthread_cond_init(&cap->edge, &attr);
+    pthread_condattr_destroy(&attr);
+    return cap;
+}
+
+// Start recording both edges of gpio, frames end after timeout us without edge.
+// An edge detection already added on gpio is shared, it must then detect both edges.
+// Return IR_CAPTURE_OK, IR_CAPTURE_STARTED if already capturing, IR_CAPTURE_EDGE if the
+// existing edge detection misses half the transitions or IR_CAPTURE_ERROR.
+int ir_capture_start(unsigned int gpio, unsigned int timeout)
+{
+    IrCapture *cap;
+    int edge;
+
+    if (gpio >= 54)
+        return IR_CAPTURE_ERROR;
+    if (captures[gpio] != NULL)
+        return IR_CAPTURE_STARTED;
+    if ((edge = gpio_event_edge(gpio)) != -1 && edge != BOTH_EDGE)
+        return IR_CAPTURE_EDGE;
+    if ((cap = new_capture(gpio, timeout)) == NULL)
+        return IR_CAPTURE_ERROR;
+    if (!gpio_event_added(gpio)) {
+        if (add_edge_detect(gpio, BOTH_EDGE, 0) != 0) {
+            pthread_cond_destroy(&cap->edge);
+            free(cap);
+            return IR_CAPTURE_ERROR;
+        }
+        cap->owned = 1;
+    }
+    pthread_mutex_lock(&capture_lock);
+    captures[gpio] = cap;
+    pthread_mutex_unlock(&capture_lock);
+    set_edge_recorder(gpio, record_edge);
+    return IR_CAPTURE_OK;
+}
+
+void ir_capture_stop(unsigned int gpio)
+{
+    IrCapture *cap;
+
+    if (gpio >= 54 || captures[gpio] == NULL)
+        return;
+    set_edge_recorder(gpio, NULL);
+    pthread_mutex_lock(&capture_lock);
+    cap = captures[gpio];
+    captures[gpio] = NULL;
+    cap->stopped = 1;     // waiting readers get the frame in progress before leaving
+    pthread_cond_broadcast(&cap->edge);
+    while (cap->readers) {    // let waiting readers leave before freeing
+        pthread_mutex_unlock(&capture_lock);
+        usleep(1000);
+        pthread_mutex_lock(&capture_lock);
+    }
+    pthread_mutex_unlock(&capture_lock);
+    if (cap->owned)
+        remove_edge_detect(gpio);
+    pthread_cond_destroy(&cap->edge);
+    free(cap);
+}
+
+void ir_capture_stop_all(void)
+{
+    unsigned int gpio;
+
+    for (gpio = 0; gpio < 54; gpio++)
+        ir_capture_stop(gpio);
+}
+
+int ir_capture_active(unsigned int gpio)
+{
+    return gpio < 54 && captures[gpio] != NULL;
+}
+
+// Turn count edges of ring from start into pulse/pause pairs. The level after the first edge is
+// the pulse level, repeated levels (edge missed by the event thread) are skipped and the last
+// pause is timeout. Return the number of pairs, -1 on memory error.
+int ir_assemble_frame(IrEdge *ring, unsigned int start, unsigned int count, unsigned int timeout, PulsePairs *pulsepairs)
+{
+    unsigned int i;
+    int active = ring[start & IR_CAPTURE_MASK].level;
+    int in_pulse = 0;
+    unsigned long long pulse_start = 0, pulse_end = 0;
+    uint32_t pulse = 0;
+
+    pulsepairs->size = 0;
+    for (i = 0; i < count; i++) {
+        IrEdge *e = &ring[(start + i) & IR_CAPTURE_MASK];
+        if (e->level == active && !in_pulse) {
+            if (pulse && add_pulsepair(pulsepairs, pulse, (uint32_t)(e->timestamp - pulse_end)) != 0)
+                return -1;
+            pulse_start = e->timestamp;
+            in_pulse = 1;
+        } else if (e->level != active && in_pulse) {
+            pulse_end = e->timestamp;
+            pulse = (uint32_t)(pulse_end - pulse_start);
+            in_pulse = 0;
+        }
+    }
+    if (pulse && !in_pulse && add_pulsepair(pulsepairs, pulse, timeout) != 0)
+        return -1;
+    return pulsepairs->size;
+}
+
+static void wait_until(IrCapture *cap, unsigned long long until)
+{
+    struct timespec ts;
+
+    ts.tv_sec = until / 1000000;
+    ts.tv_nsec = (until % 1000000) * 1000;
+    pthread_cond_timedwait(&cap->edge, &capture_lock, &ts);
+}
+
+// Read the next frame of at least PULSEPAIR_MINPAIRS pairs captured on gpio into pulsepairs.
+// Wait up to wait_ms for the first edge (-1 forever), a started frame is always waited to its end.
+// When the capture is stopped meanwhile, the edges already recorded end the frame, so a waiting
+// reader gets the last frame, partial or not, before IR_FRAME_NOCAPTURE.
+// The CPU sleeps between edges. Must not be called from an event callback, as the event thread
+// records the edges. Return IR_FRAME_OK, IR_FRAME_NONE or an error.
+int ir_capture_frame(unsigned int gpio, PulsePairs *pulsepairs, int wait_ms)
+{
+    IrCapture *cap;
+    unsigned long long now, deadline, last;
+    unsigned int i, count;
+    int result = IR_FRAME_NONE;
+
+    if (gpio >= 54 || event_thread_current())
+        return IR_FRAME_NOCAPTURE;
+    deadline = edge_timestamp() + (wait_ms < 0 ? 0 : (unsigned long long)wait_ms * 1000);
+    pthread_mutex_lock(&capture_lock);
+    if ((cap = captures[gpio]) == NULL) {
+        pthread_mutex_unlock(&capture_lock);
+        return IR_FRAME_NOCAPTURE;
+    }
+    cap->readers++;
+    for (;;) {
+        now = edge_timestamp();
+        count = cap->head - cap->tail;
+        if (count == 0) {
+            if (cap->stopped || (wait_ms >= 0 && now >= deadline))
+                break;
+            if (wait_ms < 0)
+                pthread_cond_wait(&cap->edge, &capture_lock);
+            else
+                wait_until(cap, deadline);
+            continue;
+        }
+
+        // frame ends at the first gap longer than timeout
+        for (i = 1; i < count; i++)
+            if (cap->ring[(cap->tail + i) & IR_CAPTURE_MASK].timestamp
+                - cap->ring[(cap->tail + i - 1) & IR_CAPTURE_MASK].timestamp > cap->timeout)
+                break;
+        last = cap->ring[(cap->tail + i - 1) & IR_CAPTURE_MASK].timestamp;
+        if (i == count && count < IR_CAPTURE_RINGSIZE && now <= last + cap->timeout && !cap->stopped) {
+            wait_until(cap, last + cap->timeout + 1);    // frame still running
+            continue;
+        }
+
+        result = ir_assemble_frame(cap->ring, cap->tail, i, cap->timeout, pulsepairs);
+        cap->tail += i;
+        if (result < 0) {
+            result = IR_FRAME_MEM_FAIL;
+            break;
+        }
+        if (result >= PULSEPAIR_MINPAIRS) {
+            result = IR_FRAME_OK;
+            break;
+        }
+        result = IR_FRAME_NONE;   // noise, look for the next frame
+    }
+    if (cap->stopped && result == IR_FRAME_NONE)
+        result = IR_FRAME_NOCAPTURE;
+    cap->readers--;
+    pthread_mutex_unlock(&capture_lock);
+    return result;
+}
+
+#ifdef IR_CAPTURE_TEST
+// Feeds recorded edges as the event thread would and checks the assembled frames. No hardware access.
+// gcc ir_capture.c event_gpio.c c_gpio.c bcm2835.c realtime.c trace.c -lpthread -D IR_CAPTURE_TEST
+// ./a.out
+
+static unsigned long long feed_frame(unsigned int gpio, unsigned long long t, unsigned int pairs, int duplicate)
+{
+    unsigned int i;
+
+    for (i = 0; i < pairs; i++) {
+        record_edge(gpio, t, 0);
+        if (duplicate && i == 1)
+            record_edge(gpio, t + 10, 0);
+        t += i ? 560 : 9000;
+        record_edge(gpio, t, 1);
+        t += i ? (i % 2 ? 1690 : 560) : 4500;
+    }
+    return t;
+}
+
+static int check_frame(PulsePairs *pulsepairs, unsigned int pairs, unsigned int timeout)
+{
+    unsigned int i;
+    int errors = 0;
+
+    if (pulsepairs->size != pairs) {
+        printf("FAIL : %u pairs, expected %u\n", pulsepairs->size, pairs);
+        return 1;
+    }
+    for (i = 0; i < pairs; i++) {
+        if (PULSEPAIR_PULSE(pulsepairs, i) != (i ? 560 : 9000))
+            errors++, printf("FAIL : pair %u pulse %u\n", i, PULSEPAIR_PULSE(pulsepairs, i));
+        if (PULSEPAIR_PAUSE(pulsepairs, i) != (i == pairs - 1 ? timeout : i ? (i % 2 ? 1690 : 560) : 4500))
+            errors++, printf("FAIL : pair %u pause %u\n", i, PULSEPAIR_PAUSE(pulsepairs, i));
+    }
+    return errors;
+}
+
+static PulsePairs stop_pairs;
+static int stop_result;
+
+static void *stop_reader(void *arg)
+{
+    stop_result = ir_capture_frame(5, &stop_pairs, -1);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static uint32_t page[1024];
+    pthread_t reader;
+    PulsePairs pulsepairs;
+    unsigned int gpio = 17, timeout = PULSEPAIR_TIMEOUTSTAGE;
+    unsigned long long t = edge_timestamp() - 2000000;
+    int errors = 0;
+
+    init_pulsepairs(&pulsepairs, 4);
+    captures[gpio] = new_capture(gpio, timeout);
+
+    t = feed_frame(gpio, t, 33, 0);
+    t = feed_frame(gpio, t + 100000, 2, 0);     // noise, fewer than PULSEPAIR_MINPAIRS pairs
+    t = feed_frame(gpio, t + 100000, 17, 1);    // repeated level edge
+
+    if (ir_capture_frame(gpio, &pulsepairs, 0) != IR_FRAME_OK)
+        errors++, printf("FAIL : first frame not read\n");
+    errors += check_frame(&pulsepairs, 33, timeout);
+    if (ir_capture_frame(gpio, &pulsepairs, 0) != IR_FRAME_OK)
+        errors++, printf("FAIL : second frame not read\n");
+    errors += check_frame(&pulsepairs, 17, timeout);
+    if (ir_capture_frame(gpio, &pulsepairs, 10) != IR_FRAME_NONE)
+        errors++, printf("FAIL : frame read from an empty ring\n");
+
+    // frame still running : the reader must wait for the gap
+    feed_frame(gpio, edge_timestamp() - 20000, 8, 0);   // last edge a few ms ago
+    if (ir_capture_frame(gpio, &pulsepairs, 0) != IR_FRAME_OK || pulsepairs.size != 8)
+        errors++, printf("FAIL : running frame not waited\n");
+
+    pthread_cond_destroy(&captures[gpio]->edge);
+    free(captures[gpio]);
+    captures[gpio] = NULL;
+    if (ir_capture_frame(gpio, &pulsepairs, 0) != IR_FRAME_NOCAPTURE)
+        errors++, printf("FAIL : read without capture\n");
+
+    // an existing edge detection is shared only when it sees both edges
+    setup_map(page);
+    set_regpoll_interval(10000000);
+    set_event_backend(EVENT_BACKEND_REGS, NULL);
+    add_edge_detect(4, RISING_EDGE, 0);
+    add_edge_detect(5, BOTH_EDGE, 0);
+    if (ir_capture_start(4, timeout) != IR_CAPTURE_EDGE || ir_capture_active(4))
+        errors++, printf("FAIL : capture on rising edge detection\n");
+    if (ir_capture_start(5, timeout) != IR_CAPTURE_OK || !ir_capture_active(5))
+        errors++, printf("FAIL : capture on both edge detection\n");
+
+    // a stop hands the frame in progress to the waiting reader
+    init_pulsepairs(&stop_pairs, 4);
+    pthread_create(&reader, NULL, stop_reader, NULL);
+    feed_frame(5, edge_timestamp(), 8, 0);
+    usleep(10000);
+    ir_capture_stop(5);
+    pthread_join(reader, NULL);
+    if (stop_result != IR_FRAME_OK || stop_pairs.size != 8)
+        errors++, printf("FAIL : frame in progress lost on stop, %d\n", stop_result);
+    free_plusepairs(&stop_pairs);
+    remove_edge_detect(4);
+    remove_edge_detect(5);
+
+    printf("%s : %d error(s)\n", errors ? "FAIL" : "OK", errors);
+    free_plusepairs(&pulsepairs);
+    return errors ? 1 : 0;
+}
+#endif
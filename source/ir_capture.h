@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* IR receive : edges timestamped by the event thread, frames assembled on read */
+
+#include <pthread.h>
+
+// Edge recorded by the event thread, timestamp in us from edge_timestamp()
+typedef struct IrEdge IrEdge;
+struct IrEdge
+{
+    unsigned long long timestamp;
+    int level;
+};
+
+#define IR_CAPTURE_RINGSIZE 1024   // edges, power of 2
+
+typedef struct IrCapture IrCapture;
+struct IrCapture
+{
+    unsigned int gpio;
+    unsigned int timeout;        // gap in us ending a frame
+    int owned;                   // edge detection added by the capture
+    IrEdge ring[IR_CAPTURE_RINGSIZE];
+    unsigned int head;           // next edge written by the event thread
+    unsigned int tail;           // next edge read
+    unsigned int overruns;       // edges lost on a full ring
+    unsigned int readers;        // threads waiting in ir_capture_frame()
+    int stopped;                 // ir_capture_stop() called, readers take what is left
+    pthread_cond_t edge;
+};
+
+int ir_capture_start(unsigned int gpio, unsigned int timeout);
+void ir_capture_stop(unsigned int gpio);
+void ir_capture_stop_all(void);
+int ir_capture_active(unsigned int gpio);
+int ir_capture_frame(unsigned int gpio, PulsePairs *pulsepairs, int wait_ms);
+int ir_assemble_frame(IrEdge *ring, unsigned int start, unsigned int count, unsigned int timeout, PulsePairs *pulsepairs);
+
+#define IR_CAPTURE_OK        0
+#define IR_CAPTURE_STARTED   1
+#define IR_CAPTURE_ERROR     2
+#define IR_CAPTURE_EDGE      3   // edge detection already added on the gpio, but not BOTH_EDGE
+
+#define IR_FRAME_NONE        0
+#define IR_FRAME_OK          1
+#define IR_FRAME_NOCAPTURE  -1
+#define IR_FRAME_MEM_FAIL   -2
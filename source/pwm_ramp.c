@@ -0,0 +1,245 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "c_gpio.h"
+#include "pwm_ramp.h"
+#include "realtime.h"
+#include "trace.h"
+
+// One ramp per PWM channel. data holds the value written at each tick, computed by
+// pwm_ramp_start() so the thread only sleeps and writes.
+struct ramp
+{
+    pthread_t thread;
+    int started;            // thread created and not joined yet
+    int running;
+    int stop;
+    unsigned int channel;
+    uint32_t *data;
+    unsigned int size;
+};
+
+static struct ramp ramps[2];
+static pthread_mutex_t ramp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Progress of the curve, 0.0 to 1.0, at t from 0.0 to 1.0
+static double curve_at(int curve, double t, const float *table, unsigned int table_size)
+{
+    double pos;
+    unsigned int i;
+
+    switch (curve)
+    {
+    case RAMP_EXPONENTIAL:
+        return (exp(RAMP_EXP_K * t) - 1.0) / (exp(RAMP_EXP_K) - 1.0);
+    case RAMP_GAMMA:
+        return pow(t, RAMP_GAMMA_VALUE);
+    case RAMP_TABLE:
+        if (table_size == 1)
+            return table[0];
+        pos = t * (table_size - 1);
+        i = (unsigned int)pos;
+        if (i >= table_size - 1)
+            return table[table_size - 1];
+        return table[i] + (table[i + 1] - table[i]) * (pos - i);
+    default:
+        return t;
+    }
+}
+
+static void *ramp_thread(void *arg)
+{
+    struct ramp *r = (struct ramp *)arg;
+    struct timespec deadline;
+    unsigned int i;
+    uint32_t last = 0;
+
+    realtime_thread_enter();
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (i = 0; i < r->size && !__atomic_load_n(&r->stop, __ATOMIC_RELAXED); i++)
+    {
+        if (i == 0 || r->data[i] != last)
+        {
+            pwm_setlevel(r->channel, r->data[i]);
+            TRACE(TRACE_PWM_RAMP, r->data[i]);
+            last = r->data[i];
+        }
+        // absolute deadlines, a late tick never delays the following ones
+        deadline.tv_nsec += RAMP_TICK_US * 1000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        if (i + 1 < r->size)
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+                ;
+    }
+    realtime_thread_leave();
+    __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Stop the ramp of r and wait for its thread, with ramp_lock held
+static void ramp_join(struct ramp *r)
+{
+    if (!r->started)
+        return;
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(r->thread, NULL);
+    r->started = 0;
+    free(r->data);
+    r->data = NULL;
+}
+
+// Ramp the data register of pwm_channel from from to to % of range over duration_ms, one step per
+// RAMP_TICK_US, along curve. A running ramp of the channel is stopped first, the register keeps
+// the last value written when the ramp ends or is stopped.
+int pwm_ramp_start(unsigned int pwm_channel, unsigned int range, float from, float to,
+                   unsigned int duration_ms, int curve, const float *table, unsigned int table_size)
+{
+    struct ramp *r;
+    unsigned int i, size;
+    uint32_t *data;
+    double t;
+
+    if (pwm_channel > 1 || from < 0.0 || from > 100.0 || to < 0.0 || to > 100.0
+        || duration_ms > RAMP_MAX_MS || curve < RAMP_LINEAR || curve > RAMP_TABLE
+        || (curve == RAMP_TABLE && (table == NULL || table_size == 0)))
+        return RAMP_INVALID;
+
+    size = duration_ms * 1000 / RAMP_TICK_US + 1;
+    if ((data = malloc(size * sizeof(uint32_t))) == NULL)
+        return RAMP_NO_MEMORY;
+    for (i = 0; i < size; i++)
+    {
+        t = size > 1 ? (double)i / (size - 1) : 1.0;
+        t = from + (to - from) * curve_at(curve, t, table, table_size);
+        if (t < 0.0)
+            t = 0.0;
+        else if (t > 100.0)
+            t = 100.0;
+        data[i] = (uint32_t)(range * t / 100.0 + 0.5);
+    }
+
+    pthread_mutex_lock(&ramp_lock);
+    r = &ramps[pwm_channel];
+    ramp_join(r);
+    r->channel = pwm_channel;
+    r->data = data;
+    r->size = size;
+    r->stop = 0;
+    r->running = 1;
+    if (pthread_create(&r->thread, NULL, ramp_thread, r) != 0)
+    {
+        r->running = 0;
+        r->data = NULL;
+        pthread_mutex_unlock(&ramp_lock);
+        free(data);
+        return RAMP_NO_THREAD;
+    }
+    r->started = 1;
+    pthread_mutex_unlock(&ramp_lock);
+    return RAMP_OK;
+}
+
+void pwm_ramp_stop(unsigned int pwm_channel)
+{
+    if (pwm_channel > 1)
+        return;
+    pthread_mutex_lock(&ramp_lock);
+    ramp_join(&ramps[pwm_channel]);
+    pthread_mutex_unlock(&ramp_lock);
+}
+
+int pwm_ramp_running(unsigned int pwm_channel)
+{
+    if (pwm_channel > 1)
+        return 0;
+    return __atomic_load_n(&ramps[pwm_channel].running, __ATOMIC_ACQUIRE);
+}
+
+#ifdef PWM_RAMP_TEST
+// Runs ramps against a simulated PWM register page.
+// gcc pwm_ramp.c c_gpio.c bcm2835.c realtime.c trace.c -lpthread -lm -D PWM_RAMP_TEST
+// ./a.out
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "bcm2835.h"
+
+extern volatile uint32_t *bcm2835_pwm;
+
+int main(int argc, char **argv)
+{
+    static uint32_t page[1024];
+    float table[3] = { 0.0, 1.0, 0.5 };
+    uint32_t *data;
+    int errors = 0;
+
+    memset(page, 0, sizeof(page));
+    bcm2835_pwm = page;
+
+    if (pwm_ramp_start(2, 1000, 0.0, 100.0, 10, RAMP_LINEAR, NULL, 0) != RAMP_INVALID
+        || pwm_ramp_start(0, 1000, 0.0, 101.0, 10, RAMP_LINEAR, NULL, 0) != RAMP_INVALID
+        || pwm_ramp_start(0, 1000, 0.0, 100.0, 10, RAMP_TABLE, NULL, 0) != RAMP_INVALID)
+        errors++, printf("FAIL : invalid ramp accepted\n");
+
+    // one value per tick, ending on the target
+    pwm_ramp_start(0, 1000, 0.0, 100.0, 20, RAMP_LINEAR, NULL, 0);
+    data = ramps[0].data;
+    if (ramps[0].size != 21 || data[0] != 0 || data[10] != 500 || data[20] != 1000)
+        errors++, printf("FAIL : linear ramp %u values, %u %u %u\n", ramps[0].size, data[0], data[10], data[20]);
+    usleep(50000);
+    if (pwm_ramp_running(0) || page[BCM2835_PWM0_DATA] != 1000)
+        errors++, printf("FAIL : PWM0_DATA %u after the ramp\n", page[BCM2835_PWM0_DATA]);
+
+    // curves slower than linear at the start
+    pwm_ramp_start(1, 1000, 0.0, 100.0, 20, RAMP_GAMMA, NULL, 0);
+    if (ramps[1].data[10] >= 500 || ramps[1].data[20] != 1000)
+        errors++, printf("FAIL : gamma ramp mid value %u\n", ramps[1].data[10]);
+    pwm_ramp_start(1, 1000, 0.0, 100.0, 20, RAMP_EXPONENTIAL, NULL, 0);
+    if (ramps[1].data[10] >= 500 || ramps[1].data[20] != 1000)
+        errors++, printf("FAIL : exponential ramp mid value %u\n", ramps[1].data[10]);
+
+    // user table interpolated, falling back to its last value
+    pwm_ramp_start(1, 1000, 20.0, 60.0, 20, RAMP_TABLE, table, 3);
+    if (ramps[1].data[0] != 200 || ramps[1].data[5] != 400 || ramps[1].data[10] != 600 || ramps[1].data[20] != 400)
+        errors++, printf("FAIL : table ramp %u %u %u %u\n", ramps[1].data[0], ramps[1].data[5], ramps[1].data[10], ramps[1].data[20]);
+
+    // stopped mid way, the register keeps its last value
+    pwm_ramp_start(1, 1000, 0.0, 100.0, 1000, RAMP_LINEAR, NULL, 0);
+    usleep(100000);
+    pwm_ramp_stop(1);
+    if (pwm_ramp_running(1) || page[BCM2835_PWM1_DATA] == 0 || page[BCM2835_PWM1_DATA] >= 1000)
+        errors++, printf("FAIL : PWM1_DATA %u after stop\n", page[BCM2835_PWM1_DATA]);
+
+    printf("%s : %d error(s)\n", errors ? "FAIL" : "OK", errors);
+    return errors ? 1 : 0;
+}
+#endif
@@ -0,0 +1,45 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Hardware PWM ramps : PWM0_DATA / PWM1_DATA stepped on a fixed tick from a background thread */
+
+#include <stdint.h>
+
+#define RAMP_LINEAR      0
+#define RAMP_EXPONENTIAL 1
+#define RAMP_GAMMA       2
+#define RAMP_TABLE       3   // user table of progress values, 0.0 to 1.0, evenly spaced along the ramp
+
+#define RAMP_TICK_US     1000     // data register update period
+#define RAMP_MAX_MS      600000   // longest ramp, one data value per tick is precomputed
+#define RAMP_EXP_K       5.0      // steepness of RAMP_EXPONENTIAL
+#define RAMP_GAMMA_VALUE 2.2      // exponent of RAMP_GAMMA
+
+int pwm_ramp_start(unsigned int pwm_channel, unsigned int range, float from, float to,
+                   unsigned int duration_ms, int curve, const float *table, unsigned int table_size);
+void pwm_ramp_stop(unsigned int pwm_channel);
+int pwm_ramp_running(unsigned int pwm_channel);
+
+#define RAMP_OK          0
+#define RAMP_INVALID     1
+#define RAMP_NO_MEMORY   2
+#define RAMP_NO_THREAD   3
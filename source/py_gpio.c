@@ -24,12 +24,23 @@ SOFTWARE.
 #include "c_gpio.h"
 #include "event_gpio.h"
 #include "py_pwm.h"
+#include "py_pin.h"
 #include "cpuinfo.h"
 #include "constants.h"
 #include "common.h"
 
 #include "bcm2835.h"
+#include "dma_ir.h"
+#include "ir_capture.h"
+#include "waveform.h"
+#include "realtime.h"
+#include "trace.h"
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 static PyObject *rpi_revision;
 static int gpio_warnings = 1;
@@ -40,7 +51,34 @@ struct py_callback
    PyObject *py_cb;
    struct py_callback *next;
 };
-static struct py_callback *py_callbacks = NULL;
+static struct py_callback *py_callbacks[54] = { NULL };   // list of callbacks per gpio
+
+// batched dispatch : the event thread only counts edges, the dispatcher thread runs the
+// callbacks of all pending channels under one GIL acquisition
+static int dispatch_batch = 0;
+static int dispatch_running = 0;
+static pthread_t dispatch_thread;
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dispatch_cond;
+static unsigned int dispatch_pending[54] = { 0 };
+static unsigned int dispatch_window[54] = { 0 };          // coalescing window in us
+static unsigned long long dispatch_last[54] = { 0 };      // last dispatch time in us
+
+// remove all python callbacks for gpio, once its edge detection is removed
+static void remove_py_callbacks(unsigned int gpio)
+{
+   struct py_callback *cb = py_callbacks[gpio];
+   struct py_callback *temp;
+
+   py_callbacks[gpio] = NULL;
+   while (cb != NULL)
+   {
+      Py_XDECREF(cb->py_cb);
+      temp = cb;
+      cb = cb->next;
+      free(temp);
+   }
+}
 
 static int init_module(void)
 {
@@ -85,8 +123,13 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
 
    if (module_setup && !setup_error) {
       if (channel == -666) {
-         // clean up any /sys/class exports
+         // clean up any /sys/class exports, without the GIL the event threads may be waiting for
+         Py_BEGIN_ALLOW_THREADS
+         ir_capture_stop_all();
          event_cleanup_all();
+         Py_END_ALLOW_THREADS
+         for (i=0; i<54; i++)
+            remove_py_callbacks(i);
 
          // set everything back to input
          for (i=0; i<54; i++) {
@@ -97,13 +140,17 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
             }
          }
       } else {
-         // clean up any /sys/class exports
+         // clean up any /sys/class exports, without the GIL the event threads may be waiting for
+         Py_BEGIN_ALLOW_THREADS
+         ir_capture_stop(gpio);
          event_cleanup(gpio);
+         Py_END_ALLOW_THREADS
+         remove_py_callbacks(gpio);
 
          // set everything back to input
          if (gpio_direction[gpio] != -1) {
             setup_gpio(gpio, INPUT, PUD_OFF);
-            gpio_direction[i] = -1;
+            gpio_direction[gpio] = -1;
             found = 1;
          }
       }
@@ -117,37 +164,30 @@ static PyObject *py_cleanup(PyObject *self, PyObject *args, PyObject *kwargs)
    Py_RETURN_NONE;
 }
 
-// python function setup(channel, direction, pull_up_down=PUD_OFF, initial=None)
-static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwargs)
+// Set up one channel as in setup() and return its gpio in *gpio. Return -1 with a Python
+// exception set on error. Also used by GPIO.Pin so both share the checks and warnings.
+int setup_channel(int channel, int direction, int pud, int initial, unsigned int *gpio)
 {
-   unsigned int gpio;
-   int channel, direction;
-   int pud = PUD_OFF + PY_PUD_CONST_OFFSET;
-   int initial = -1;
-   static char *kwlist[] = {"channel", "direction", "pull_up_down", "initial", NULL};
    int func;
 
-   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|ii", kwlist, &channel, &direction, &pud, &initial))
-      return NULL;
-
    // check module has been imported cleanly
    if (setup_error)
    {
       PyErr_SetString(PyExc_RuntimeError, "Module not imported correctly!");
-      return NULL;
+      return -1;
    }
 
    // run init_module if module not set up
    if (!module_setup && (init_module() != SETUP_OK))
-      return NULL;
+      return -1;
 
-   if (get_gpio_number(channel, &gpio))
-      return NULL;
+   if (get_gpio_number(channel, gpio))
+      return -1;
 
    if (direction != INPUT && direction != OUTPUT)
    {
       PyErr_SetString(PyExc_ValueError, "An invalid direction was passed to setup()");
-      return NULL;
+      return -1;
    }
 
    if (direction == OUTPUT)
@@ -157,55 +197,172 @@ static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwar
    if (pud != PUD_OFF && pud != PUD_DOWN && pud != PUD_UP)
    {
       PyErr_SetString(PyExc_ValueError, "Invalid value for pull_up_down - should be either PUD_OFF, PUD_UP or PUD_DOWN");
-      return NULL;
+      return -1;
    }
 
-   func = gpio_function(gpio);
+   func = gpio_function(*gpio);
    if (gpio_warnings &&                             // warnings enabled and
        ((func != 0 && func != 1) ||                 // (already one of the alt functions or
-       (gpio_direction[gpio] == -1 && func == 1)))  // already an output not set from this program)
+       (gpio_direction[*gpio] == -1 && func == 1)))  // already an output not set from this program)
    {
       PyErr_WarnEx(NULL, "This channel is already in use, continuing anyway.  Use GPIO.setwarnings(False) to disable warnings.", 1);
    }
 
    if (direction == OUTPUT && (initial == LOW || initial == HIGH))
    {
-      output_gpio(gpio, initial);
+      output_gpio(*gpio, initial);
    }
-   setup_gpio(gpio, direction, pud);
-   gpio_direction[gpio] = direction;
+   setup_gpio(*gpio, direction, pud);
+   gpio_direction[*gpio] = direction;
+   return 0;
+}
+
+// python function setup(channel, direction, pull_up_down=PUD_OFF, initial=None)
+static PyObject *py_setup_channel(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   unsigned int gpio;
+   int channel, direction;
+   int pud = PUD_OFF + PY_PUD_CONST_OFFSET;
+   int initial = -1;
+   static char *kwlist[] = {"channel", "direction", "pull_up_down", "initial", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ii|ii", kwlist, &channel, &direction, &pud, &initial))
+      return NULL;
+
+   if (setup_channel(channel, direction, pud, initial, &gpio))
+      return NULL;
 
    Py_RETURN_NONE;
 }
 
-// python function output(channel, value)
+// Convert a list or tuple of channels to gpios, at most 54. Return the number of gpios, -1 on error.
+static int get_gpio_list(PyObject *channels, unsigned int *gpios)
+{
+   Py_ssize_t i, n = PySequence_Fast_GET_SIZE(channels);
+   long channel;
+
+   if (n > 54) {
+      PyErr_SetString(PyExc_ValueError, "Too many channels");
+      return -1;
+   }
+   for (i = 0; i < n; i++) {
+      channel = PyLong_AsLong(PySequence_Fast_GET_ITEM(channels, i));
+      if (channel == -1 && PyErr_Occurred())
+         return -1;
+      if (get_gpio_number((int)channel, &gpios[i]))
+         return -1;
+   }
+   return (int)n;
+}
+
+// python function output(channel, value), channel and value may be lists or tuples, all the
+// outputs then change with one write in GPSET and one in GPCLR
 static PyObject *py_output_gpio(PyObject *self, PyObject *args)
 {
-   unsigned int gpio;
-   int channel, value;
+   unsigned int gpio, gpios[54];
+   int channel, value, i, n;
+   uint64_t set = 0, clr = 0;
+   PyObject *channels, *values, *seq, *vseq = NULL;
 
-   if (!PyArg_ParseTuple(args, "ii", &channel, &value))
+   if (!PyArg_ParseTuple(args, "OO", &channels, &values))
       return NULL;
 
-   if (get_gpio_number(channel, &gpio))
-       return NULL;
+   if (!PyList_Check(channels) && !PyTuple_Check(channels)) {
+      if (!PyArg_ParseTuple(args, "ii", &channel, &value))
+         return NULL;
 
-   if (gpio_direction[gpio] != OUTPUT)
-   {
-      PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+      if (get_gpio_number(channel, &gpio))
+          return NULL;
+
+      if (gpio_direction[gpio] != OUTPUT)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+         return NULL;
+      }
+
+      output_gpio(gpio, value);
+      Py_RETURN_NONE;
+   }
+
+   seq = PySequence_Fast(channels, "channel must be a channel or a list of channels");
+   if (seq == NULL)
       return NULL;
+   if ((n = get_gpio_list(seq, gpios)) < 0)
+      goto error;
+   if (PyList_Check(values) || PyTuple_Check(values)) {
+      if ((vseq = PySequence_Fast(values, "value must be a value or a list of values")) == NULL)
+         goto error;
+      if (PySequence_Fast_GET_SIZE(vseq) != n) {
+         PyErr_SetString(PyExc_ValueError, "Number of channels != number of values");
+         goto error;
+      }
+   } else if ((value = PyObject_IsTrue(values)) == -1) {
+      goto error;
    }
 
-   output_gpio(gpio, value);
+   for (i = 0; i < n; i++) {
+      if (gpio_direction[gpios[i]] != OUTPUT)
+      {
+         PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+         goto error;
+      }
+      if (vseq != NULL && (value = PyObject_IsTrue(PySequence_Fast_GET_ITEM(vseq, i))) == -1)
+         goto error;
+      if (value)
+         set |= 1ULL << gpios[i];
+      else
+         clr |= 1ULL << gpios[i];
+   }
+   output_gpio_mask(set, clr);
+   Py_DECREF(seq);
+   Py_XDECREF(vseq);
    Py_RETURN_NONE;
+
+error:
+   Py_DECREF(seq);
+   Py_XDECREF(vseq);
+   return NULL;
 }
 
-// python function value = input(channel)
+// python function value = input(channel), for a list or tuple of channels return the list of
+// values from one read of GPLEV
 static PyObject *py_input_gpio(PyObject *self, PyObject *args)
 {
-   unsigned int gpio;
-   int channel;
-   PyObject *value;
+   unsigned int gpio, gpios[54];
+   int channel, i, n;
+   uint64_t levels;
+   PyObject *value, *item, *channels, *seq;
+
+   if (!PyArg_ParseTuple(args, "O", &channels))
+      return NULL;
+
+   if (PyList_Check(channels) || PyTuple_Check(channels)) {
+      seq = PySequence_Fast(channels, "channel must be a channel or a list of channels");
+      if (seq == NULL)
+         return NULL;
+      n = get_gpio_list(seq, gpios);
+      Py_DECREF(seq);
+      if (n < 0)
+         return NULL;
+      for (i = 0; i < n; i++) {
+         if (gpio_direction[gpios[i]] != INPUT && gpio_direction[gpios[i]] != OUTPUT)
+         {
+            PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+            return NULL;
+         }
+      }
+      levels = level_mask();
+      if ((value = PyList_New(n)) == NULL)
+         return NULL;
+      for (i = 0; i < n; i++) {
+         if ((item = Py_BuildValue("i", (levels >> gpios[i]) & 1 ? HIGH : LOW)) == NULL) {
+            Py_DECREF(value);
+            return NULL;
+         }
+         PyList_SET_ITEM(value, i, item);
+      }
+      return value;
+   }
 
    if (!PyArg_ParseTuple(args, "i", &channel))
       return NULL;
@@ -261,35 +418,152 @@ static unsigned int chan_from_gpio(unsigned int gpio)
    return -1;
 }
 
-static void run_py_callbacks(unsigned int gpio)
+static void call_py_callbacks(unsigned int gpio)
 {
    PyObject *result;
-   PyGILState_STATE gstate;
-   struct py_callback *cb = py_callbacks;
+   struct py_callback *cb = py_callbacks[gpio];
 
    while (cb != NULL)
    {
-      if (cb->gpio == gpio) {
-         // run callback
-         gstate = PyGILState_Ensure();
-         result = PyObject_CallFunction(cb->py_cb, "i", chan_from_gpio(gpio));
-         if (result == NULL && PyErr_Occurred()){
-            PyErr_Print();
-            PyErr_Clear();
+      result = PyObject_CallFunction(cb->py_cb, "i", chan_from_gpio(gpio));
+      if (result == NULL && PyErr_Occurred()){
+         PyErr_Print();
+         PyErr_Clear();
+      }
+      Py_XDECREF(result);
+      cb = cb->next;
+   }
+}
+
+static void *dispatch_callbacks(void *threadarg)
+{
+   unsigned int gpio, calls[54];
+   unsigned long long now, wake;
+   struct timespec ts;
+   PyGILState_STATE gstate;
+   int ready;
+
+   pthread_mutex_lock(&dispatch_lock);
+   while (dispatch_running) {
+      // take the channels out of their window, the others stay pending
+      now = edge_timestamp();
+      wake = 0;
+      ready = 0;
+      for (gpio = 0; gpio < 54; gpio++) {
+         calls[gpio] = 0;
+         if (dispatch_pending[gpio] == 0)
+            continue;
+         if (dispatch_window[gpio] == 0) {
+            calls[gpio] = dispatch_pending[gpio];      // one call per edge
+         } else if (now - dispatch_last[gpio] >= dispatch_window[gpio]) {
+            calls[gpio] = 1;                           // edges of the window coalesced
+         } else {
+            if (wake == 0 || dispatch_last[gpio] + dispatch_window[gpio] < wake)
+               wake = dispatch_last[gpio] + dispatch_window[gpio];
+            continue;
          }
-         Py_XDECREF(result);
+         dispatch_pending[gpio] = 0;
+         dispatch_last[gpio] = now;
+         ready = 1;
+      }
+
+      if (ready) {
+         pthread_mutex_unlock(&dispatch_lock);
+         gstate = PyGILState_Ensure();
+         for (gpio = 0; gpio < 54; gpio++)
+            while (calls[gpio]--)
+               call_py_callbacks(gpio);
          PyGILState_Release(gstate);
+         pthread_mutex_lock(&dispatch_lock);
+      } else if (wake) {
+         ts.tv_sec = wake / 1000000;
+         ts.tv_nsec = (wake % 1000000) * 1000;
+         pthread_cond_timedwait(&dispatch_cond, &dispatch_lock, &ts);
+      } else {
+         pthread_cond_wait(&dispatch_cond, &dispatch_lock);
       }
-      cb = cb->next;
    }
+   pthread_mutex_unlock(&dispatch_lock);
+   pthread_exit(NULL);
+}
+
+// Called once at module init, set_callback_window() may signal the cond before any start
+static void dispatch_init(void)
+{
+   pthread_condattr_t attr;
+
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);   // same time base as edge_timestamp()
+   pthread_cond_init(&dispatch_cond, &attr);
+   pthread_condattr_destroy(&attr);
+}
+
+static int dispatch_start(void)
+{
+   if (dispatch_running)
+      return 0;
+   dispatch_running = 1;
+   if (pthread_create(&dispatch_thread, NULL, dispatch_callbacks, NULL) != 0) {
+      dispatch_running = 0;
+      return -1;
+   }
+   return 0;
+}
+
+// Ask the dispatcher to leave, return 1 if it was running
+static int dispatch_halt(void)
+{
+   int running;
+
+   pthread_mutex_lock(&dispatch_lock);
+   dispatch_batch = 0;
+   running = dispatch_running;
+   if (running) {
+      dispatch_running = 0;
+      pthread_cond_signal(&dispatch_cond);
+   }
+   pthread_mutex_unlock(&dispatch_lock);
+   return running;
+}
+
+// Stop the dispatcher and wait for it, so a start never finds two draining the queue.
+// Called without the GIL, the dispatcher may be waiting for it.
+static void dispatch_stop(void)
+{
+   if (dispatch_halt())
+      pthread_join(dispatch_thread, NULL);
+}
+
+// At exit the interpreter is gone and the dispatcher may never get the GIL back, so no join
+static void dispatch_exit(void)
+{
+   dispatch_halt();
+}
+
+static void run_py_callbacks(unsigned int gpio)
+{
+   PyGILState_STATE gstate;
+
+   if (dispatch_batch) {
+      pthread_mutex_lock(&dispatch_lock);
+      dispatch_pending[gpio]++;
+      pthread_cond_signal(&dispatch_cond);
+      pthread_mutex_unlock(&dispatch_lock);
+      return;
+   }
+
+   // the list is only walked under the GIL, remove_py_callbacks() frees it under the GIL
+   gstate = PyGILState_Ensure();
+   call_py_callbacks(gpio);
+   PyGILState_Release(gstate);
 }
 
 static int add_py_callback(unsigned int gpio, PyObject *cb_func)
 {
    struct py_callback *new_py_cb;
-   struct py_callback *cb = py_callbacks;
+   struct py_callback *cb = py_callbacks[gpio];
 
-   // add callback to py_callbacks list
+   // add callback to py_callbacks list of gpio
    new_py_cb = malloc(sizeof(struct py_callback));
    if (new_py_cb == 0)
    {
@@ -300,15 +574,21 @@ static int add_py_callback(unsigned int gpio, PyObject *cb_func)
    Py_XINCREF(cb_func);         // Add a reference to new callback
    new_py_cb->gpio = gpio;
    new_py_cb->next = NULL;
-   if (py_callbacks == NULL) {
-      py_callbacks = new_py_cb;
+   if (cb == NULL) {
+      // run_py_callbacks runs every callback of gpio, register it once
+      if (add_edge_callback(gpio, run_py_callbacks) != 0) {
+         Py_XDECREF(cb_func);
+         free(new_py_cb);
+         PyErr_NoMemory();
+         return -1;
+      }
+      py_callbacks[gpio] = new_py_cb;
    } else {
       // add to end of list
       while (cb->next != NULL)
          cb = cb->next;
       cb->next = new_py_cb;
    }
-   add_edge_callback(gpio, run_py_callbacks);
    return 0;
 }
 
@@ -387,7 +667,10 @@ static PyObject *py_add_event_detect(PyObject *self, PyObject *args, PyObject *k
       return NULL;
    }
 
-   if ((result = add_edge_detect(gpio, edge, bouncetime)) != 0)   // starts a thread
+   Py_BEGIN_ALLOW_THREADS   // may join a leftover event thread
+   result = add_edge_detect(gpio, edge, bouncetime);   // starts a thread
+   Py_END_ALLOW_THREADS
+   if (result != 0)
    {
       if (result == 1)
       {
@@ -411,9 +694,6 @@ static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
 {
    unsigned int gpio;
    int channel;
-   struct py_callback *cb = py_callbacks;
-   struct py_callback *temp;
-   struct py_callback *prev = NULL;
 
    if (!PyArg_ParseTuple(args, "i", &channel))
       return NULL;
@@ -421,26 +701,13 @@ static PyObject *py_remove_event_detect(PyObject *self, PyObject *args)
    if (get_gpio_number(channel, &gpio))
        return NULL;
 
-   // remove all python callbacks for gpio
-   while (cb != NULL)
-   {
-      if (cb->gpio == gpio)
-      {
-         Py_XDECREF(cb->py_cb);
-         if (prev == NULL)
-            py_callbacks = cb->next;
-         else
-            prev->next = cb->next;
-         temp = cb;
-         cb = cb->next;
-         free(temp);
-      } else {
-         prev = cb;
-         cb = cb->next;
-      }
-   }
-
+   // remove edge detection first, so the event thread no longer runs the python callbacks.
+   // It may join the event thread, which can be waiting for the GIL to run them.
+   Py_BEGIN_ALLOW_THREADS
    remove_edge_detect(gpio);
+   Py_END_ALLOW_THREADS
+
+   remove_py_callbacks(gpio);
 
    Py_RETURN_NONE;
 }
@@ -463,6 +730,232 @@ static PyObject *py_event_detected(PyObject *self, PyObject *args)
       Py_RETURN_FALSE;
 }
 
+// python function read_edges(channel, max=EDGE_RING_SIZE)
+static PyObject *py_read_edges(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   unsigned int gpio;
+   int channel, i, n;
+   unsigned int max = EDGE_RING_SIZE;
+   unsigned int lost;
+   struct edge_record *records;
+   PyObject *list, *item;
+   static char *kwlist[] = {"channel", "max", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|I", kwlist, &channel, &max))
+      return NULL;
+
+   if (get_gpio_number(channel, &gpio))
+       return NULL;
+
+   if (max == 0 || max > EDGE_RING_SIZE)
+      max = EDGE_RING_SIZE;
+   if ((records = malloc(sizeof(struct edge_record) * max)) == NULL)
+      return PyErr_NoMemory();
+
+   if ((n = read_edges(gpio, records, max, &lost)) < 0) {
+      free(records);
+      PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before reading edges");
+      return NULL;
+   }
+   if (lost && gpio_warnings) {
+      if (PyErr_WarnEx(NULL, "Edges lost on a full ring buffer, call read_edges more often.  Use GPIO.setwarnings(False) to disable warnings.", 1) == -1) {
+         free(records);
+         return NULL;
+      }
+   }
+
+   if ((list = PyList_New(n)) == NULL) {
+      free(records);
+      return NULL;
+   }
+   for (i = 0; i < n; i++) {
+      if ((item = Py_BuildValue("(Ki)", records[i].timestamp, records[i].level)) == NULL) {
+         Py_DECREF(list);
+         free(records);
+         return NULL;
+      }
+      PyList_SET_ITEM(list, i, item);
+   }
+   free(records);
+   return list;
+}
+
+// python function set_trace(enable)
+static PyObject *py_set_trace(PyObject *self, PyObject *args)
+{
+   int enable;
+
+   if (!PyArg_ParseTuple(args, "i", &enable))
+      return NULL;
+
+   trace_enable(enable);
+   Py_RETURN_NONE;
+}
+
+// python function read_trace(max=TRACE_RING_SIZE)
+static PyObject *py_read_trace(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   unsigned int max = TRACE_RING_SIZE;
+   unsigned int i, n, lost;
+   struct trace_record *records;
+   PyObject *list, *item;
+   static char *kwlist[] = {"max", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|I", kwlist, &max))
+      return NULL;
+
+   if (max == 0 || max > TRACE_RING_SIZE)
+      max = TRACE_RING_SIZE;
+   if ((records = malloc(sizeof(struct trace_record) * max)) == NULL)
+      return PyErr_NoMemory();
+
+   n = read_trace(records, max, &lost);
+   if (lost && gpio_warnings) {
+      if (PyErr_WarnEx(NULL, "Trace records overwritten, call read_trace more often.  Use GPIO.setwarnings(False) to disable warnings.", 1) == -1) {
+         free(records);
+         return NULL;
+      }
+   }
+
+   if ((list = PyList_New(n)) == NULL) {
+      free(records);
+      return NULL;
+   }
+   for (i = 0; i < n; i++) {
+      if ((item = Py_BuildValue("(KII)", (unsigned long long)records[i].timestamp, records[i].id, records[i].arg)) == NULL) {
+         Py_DECREF(list);
+         free(records);
+         return NULL;
+      }
+      PyList_SET_ITEM(list, i, item);
+   }
+   free(records);
+   return list;
+}
+
+// python function set_event_batch(size)
+static PyObject *py_set_event_batch(PyObject *self, PyObject *args)
+{
+   unsigned int size;
+
+   if (!PyArg_ParseTuple(args, "I", &size))
+      return NULL;
+
+   if (set_event_batch(size) != 0) {
+      PyErr_Format(PyExc_ValueError, "The batch size must be 1 to %d", EVENT_BATCH_MAX);
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// python function set_event_backend(backend, chip='/dev/gpiochip0')
+static PyObject *py_set_event_backend(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int backend, result;
+   char *chip = "/dev/gpiochip0";
+   static char *kwlist[] = {"backend", "chip", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|s", kwlist, &backend, &chip))
+      return NULL;
+
+   if (backend != EVENT_BACKEND_SYSFS && backend != EVENT_BACKEND_CDEV && backend != EVENT_BACKEND_REGS) {
+      PyErr_SetString(PyExc_ValueError, "The backend must be EVENT_SYSFS, EVENT_CDEV or EVENT_REGS");
+      return NULL;
+   }
+   result = set_event_backend(backend, chip);
+   if (result == -2) {
+      PyErr_SetString(PyExc_RuntimeError, "EVENT_CDEV needs RPi.GPIO built against kernel headers 5.10 or newer");
+      return NULL;
+   }
+   if (result != 0) {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to set the event backend, remove all edge detection first and check the chip device");
+      return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// python function set_regpoll_interval(interval)
+static PyObject *py_set_regpoll_interval(PyObject *self, PyObject *args)
+{
+   unsigned int interval;
+
+   if (!PyArg_ParseTuple(args, "I", &interval))
+      return NULL;
+
+   set_regpoll_interval(interval);
+   Py_RETURN_NONE;
+}
+
+// python function set_realtime(policy, priority=0, cpu=-1, lock_memory=False, scope=REALTIME_THREADS|REALTIME_CALLS)
+static PyObject *py_set_realtime(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int policy, priority = 0, cpu = -1, lock_memory = 0;
+   int scope = REALTIME_THREADS | REALTIME_CALLS;
+   static char *kwlist[] = {"policy", "priority", "cpu", "lock_memory", "scope", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|iiii", kwlist, &policy, &priority, &cpu, &lock_memory, &scope))
+      return NULL;
+
+   switch (set_realtime(policy, priority, cpu, lock_memory, scope)) {
+      case REALTIME_INVALID:
+         PyErr_SetString(PyExc_ValueError, "Invalid policy, priority or cpu");
+         return NULL;
+      case REALTIME_NOT_ALLOWED:
+         PyErr_SetString(PyExc_RuntimeError, "Not allowed to change the scheduling.  Try running as root!");
+         return NULL;
+      case REALTIME_LOCK_FAIL:
+         PyErr_SetString(PyExc_RuntimeError, "Failed to lock the process memory.  Try running as root!");
+         return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// python function set_debounce(channel, mode, time)
+static PyObject *py_set_debounce(PyObject *self, PyObject *args)
+{
+   unsigned int gpio, time;
+   int channel, mode;
+
+   if (!PyArg_ParseTuple(args, "iiI", &channel, &mode, &time))
+      return NULL;
+
+   if (get_gpio_number(channel, &gpio))
+      return NULL;
+
+   if (mode != DEBOUNCE_IGNORE && mode != DEBOUNCE_STABLE) {
+      PyErr_SetString(PyExc_ValueError, "The mode must be DEBOUNCE_IGNORE or DEBOUNCE_STABLE");
+      return NULL;
+   }
+   switch (set_debounce(gpio, mode, time)) {
+      case 0:
+         break;
+      case -2:
+         PyErr_Format(PyExc_RuntimeError, "Failed to create the debounce timer: %s", strerror(errno));
+         return NULL;
+      case -3:
+         PyErr_Format(PyExc_RuntimeError, "Failed to watch the debounce timer: %s", strerror(errno));
+         return NULL;
+      default:
+         PyErr_SetString(PyExc_RuntimeError, "Add event detection using add_event_detect first before setting debounce");
+         return NULL;
+   }
+   Py_RETURN_NONE;
+}
+
+// python function event_stats(reset=False)
+static PyObject *py_event_stats(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+   int reset = 0;
+   struct event_stats stats;
+   static char *kwlist[] = {"reset", NULL};
+
+   if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &reset))
+      return NULL;
+
+   get_event_stats(&stats, reset);
+   return Py_BuildValue("{s:K,s:K,s:I}", "wakeups", stats.wakeups, "events", stats.events, "max_batch", stats.max_batch);
+}
+
 // python function py_wait_for_edge(gpio, edge)
 static PyObject *py_wait_for_edge(PyObject *self, PyObject *args)
 {
@@ -566,6 +1059,52 @@ static PyObject *py_gpio_function(PyObject *self, PyObject *args)
    return func;
 }
 
+// python function set_callback_dispatch(batch)
+static PyObject *py_set_callback_dispatch(PyObject *self, PyObject *args)
+{
+   int batch;
+
+   if (!PyArg_ParseTuple(args, "i", &batch))
+      return NULL;
+
+   if (dispatch_running && pthread_equal(pthread_self(), dispatch_thread)) {
+      PyErr_SetString(PyExc_RuntimeError, "set_callback_dispatch can not be called from a callback");
+      return NULL;
+   }
+
+   if (batch) {
+      if (dispatch_start() != 0) {
+         PyErr_SetString(PyExc_RuntimeError, "Failed to start the callback dispatcher");
+         return NULL;
+      }
+      dispatch_batch = 1;
+   } else {
+      Py_BEGIN_ALLOW_THREADS
+      dispatch_stop();
+      Py_END_ALLOW_THREADS
+   }
+   Py_RETURN_NONE;
+}
+
+// python function set_callback_window(channel, window)
+static PyObject *py_set_callback_window(PyObject *self, PyObject *args)
+{
+   unsigned int gpio, window;
+   int channel;
+
+   if (!PyArg_ParseTuple(args, "iI", &channel, &window))
+      return NULL;
+
+   if (get_gpio_number(channel, &gpio))
+      return NULL;
+
+   pthread_mutex_lock(&dispatch_lock);
+   dispatch_window[gpio] = window;
+   pthread_cond_signal(&dispatch_cond);
+   pthread_mutex_unlock(&dispatch_lock);
+   Py_RETURN_NONE;
+}
+
 // python function setwarnings(state)
 static PyObject *py_setwarnings(PyObject *self, PyObject *args)
 {
@@ -670,7 +1209,6 @@ static PyObject *py_bcm2835_waitpull_gpio(PyObject *self, PyObject *args)
         {
             // Now clear the eds flag by setting it to 1
             bcm2835_gpio_set_eds(gpio);
-            printf("event detect for pin 15\n");
         }
     Py_RETURN_NONE;
 }
@@ -705,107 +1243,337 @@ static PyObject *py_bcm2835_input_gpio(PyObject *self, PyObject *args)
    return value;
 }
 
-// python method PWM.sendPulsePairs(self, PulsePairsTab, Level)
+// python function BCMWriteMask(value, mask)
+static PyObject *py_bcm2835_write_mask(PyObject *self, PyObject *args)
+{
+   unsigned int value, mask;
+
+   if (!PyArg_ParseTuple(args, "II", &value, &mask))
+      return NULL;
+
+   bcm2835_gpio_write_mask(value, mask);
+   Py_RETURN_NONE;
+}
+
+// python function (lev0, lev1) = BCMReadLevels()
+static PyObject *py_bcm2835_read_levels(PyObject *self, PyObject *args)
+{
+   uint32_t levels[2];
+
+   bcm2835_gpio_lev_multi(levels);
+   return Py_BuildValue("(II)", levels[0], levels[1]);
+}
+
+// Fill step from a (set_mask, clr_mask, delay_ns) sequence of 32 bits unsigned values.
+// Return 0 on success, otherwise set a python exception and return -1.
+static int wave_step_from_object(PyObject *item, WaveStep *step)
+{
+   PyObject *fields;
+   unsigned long values[3];
+   int i;
+
+   fields = PySequence_Fast(item, "Each step must be a (set_mask, clr_mask, delay_ns) sequence.");
+   if (fields == NULL)
+      return -1;
+   if (PySequence_Fast_GET_SIZE(fields) != 3)
+   {
+      PyErr_SetString(PyExc_ValueError, "Each step must be a (set_mask, clr_mask, delay_ns) sequence.");
+      Py_DECREF(fields);
+      return -1;
+   }
+   for (i = 0; i < 3; i++)
+   {
+      values[i] = PyLong_AsUnsignedLong(PySequence_Fast_GET_ITEM(fields, i));
+      if (values[i] == (unsigned long)-1 && PyErr_Occurred())
+      {
+         if (PyErr_ExceptionMatches(PyExc_OverflowError))
+            PyErr_SetString(PyExc_ValueError, "Step masks and delay must be 32 bits unsigned values.");
+         Py_DECREF(fields);
+         return -1;
+      }
+      if (values[i] > UINT32_MAX)
+      {
+         PyErr_SetString(PyExc_ValueError, "Step masks and delay must be 32 bits unsigned values.");
+         Py_DECREF(fields);
+         return -1;
+      }
+   }
+   Py_DECREF(fields);
+   step->set_mask = (uint32_t)values[0];
+   step->clr_mask = (uint32_t)values[1];
+   step->delay_ns = (uint32_t)values[2];
+   return 0;
+}
+
+// python function (max_late, mean_late, late_steps, drift) = BCMPlayWaveform(steps, priority=0, cpu=-1)
+// steps is a sequence of (set_mask, clr_mask, delay_ns).
+static PyObject *py_bcm2835_play_waveform(PyObject *self, PyObject *args)
+{
+   PyObject *tab, *seq, *item;
+   Py_ssize_t i, size;
+   WaveStep *steps;
+   WaveStats stats;
+   int priority = 0;
+   int cpu = -1;
+   int result;
+
+   if (!PyArg_ParseTuple(args, "O|ii", &tab, &priority, &cpu))
+      return NULL;
+
+   if (priority < 0 || priority > sched_get_priority_max(SCHED_FIFO))
+   {
+      PyErr_SetString(PyExc_ValueError, "Invalid value for priority");
+      return NULL;
+   }
+
+   seq = PySequence_Fast(tab, "steps must be a list or tuple of (set_mask, clr_mask, delay_ns)");
+   if (seq == NULL)
+      return NULL;
+   size = PySequence_Fast_GET_SIZE(seq);
+   steps = malloc((size ? size : 1) * sizeof(WaveStep));
+   if (steps == NULL)
+   {
+      Py_DECREF(seq);
+      return PyErr_NoMemory();
+   }
+   for (i = 0; i < size; i++)
+   {
+      item = PySequence_Fast_GET_ITEM(seq, i);
+      if (wave_step_from_object(item, &steps[i]) != 0)
+      {
+         free(steps);
+         Py_DECREF(seq);
+         return NULL;
+      }
+   }
+   Py_DECREF(seq);
+
+   Py_BEGIN_ALLOW_THREADS
+   result = waveform_play(steps, (unsigned int)size, priority, cpu, &stats);
+   Py_END_ALLOW_THREADS
+   free(steps);
+
+   if (result != WAVEFORM_OK)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "Failed to map the BCM2835 registers");
+      return NULL;
+   }
+   return Py_BuildValue("(IdIl)", stats.max_late,
+                        stats.late_steps ? (double)stats.sum_late / stats.late_steps : 0.0,
+                        stats.late_steps, stats.drift);
+}
+
+// python function BCMPulsePairsGPIO(PulsePairsTab, gpio, frequency=38000.0, dutycycle=50.0)
+// PulsePairsTab is a list of [pulse, pause] or a flat interleaved pulse/pause uint32 buffer read in place.
 static PyObject *py_bcm2835_sendPulsePairs(PyObject *self, PyObject *args)
 {
-    int i, size, subsize;
     unsigned int gpio;
-    PulsePairs *pulsepairs;
-    PulsePair pair;
-
+    float frequency = IR_CARRIER_FREQUENCY;
+    float dutycycle = IR_CARRIER_DUTYCYCLE;
+    PulsePairs pulsepairs, measured;
+    Py_buffer view;
+    long drift;
     PyObject *tab;
-    PyObject *item;
-    long pulse, pause;
+    PyObject *result;
     
-    printf("****** sendPulsePairs ******\n");
-    if (!PyArg_ParseTuple(args, "O!I", &PyList_Type, &tab, &gpio)) {
-        printf("--- error parsed tuple");
+    if (!PyArg_ParseTuple(args, "OI|ff", &tab, &gpio, &frequency, &dutycycle)) {
         PyErr_SetString(PyExc_ValueError,  " +++ error parsetuple");
         return NULL;
     }
+    if (frequency <= 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "frequency must be greater than 0.0");
+        return NULL;
+    }
+    if (dutycycle <= 0.0 || dutycycle > 100.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "dutycycle must have a value from 0.0 to 100.0");
+        return NULL;
+    }
     
-    if (!PyList_Check(tab)) {
-        printf("--- Not a list\n");
-        if (!PyDict_Check(tab)) printf("--- Not a Dict\n");
+    if (pulsepairs_from_object(tab, &pulsepairs, &view) != 0)
+        return NULL;
+    if (pulsepairs_measure_buffer(&pulsepairs, &measured) != 0) {
+        pulsepairs_release(&pulsepairs, &view);
         return NULL;
     }
-    size = PyList_Size(tab);
-    printf("List pulse pair size : %d, on gpio : %d\n", size, gpio);
-    if (size < 0) { /* Not a list */
-        PyErr_SetString(PyExc_ValueError, "Empty pulse / pairs table");
-        return NULL; 
+    if (gpio_sendpulsepairs(gpio, &pulsepairs, frequency, dutycycle, &measured, &drift) == PWM_BUSY) {
+        PyErr_SetString(PyExc_RuntimeError, "The PWM channel of this gpio or its clock is used by a PWM2835");
+        result = NULL;
+    } else {
+        result = pulsepairs_to_report(&measured, drift);
     }
-    pulsepairs = malloc(sizeof(PulsePairs));
-    pulsepairs->size = size;
-    pulsepairs->pairs = malloc(sizeof(int *) * size);
-    printf("taille allouer\n");
-    for (i = 0; i < size; i++) {
-        item = PyList_GetItem(tab, i); /* Can't fail */
-        subsize = PyList_Size(item);
-        if (!PyList_Check(item)) { /* Skip list object */
-            PyErr_SetString(PyExc_ValueError, "Not a list pulse pair format.");
-            return NULL;
-        }
-        if (subsize != 2) {
-            PyErr_SetString(PyExc_ValueError, "Not a pulse pair format.");
-            return NULL;
-        }
-        pulse = PyInt_AsLong(PyList_GetItem(item, 0));
-        pause = PyInt_AsLong(PyList_GetItem(item, 1));
-        pulsepairs->pairs[i] = malloc(sizeof(long *) * 2);
-        pulsepairs->pairs[i][0] = pulse;
-        pulsepairs->pairs[i][1] = pause;
+    free_plusepairs(&measured);
+    pulsepairs_release(&pulsepairs, &view);
+    return result;
+}
+
+// python function BCMPulsePairsDMA(PulsePairsTab, gpio, frequency=38000.0, dutycycle=50.0)
+// Same frame as BCMPulsePairsGPIO, played by a DMA channel paced by the PWM FIFO.
+static PyObject *py_bcm2835_sendPulsePairsDMA(PyObject *self, PyObject *args)
+{
+    unsigned int gpio;
+    float frequency = IR_CARRIER_FREQUENCY;
+    float dutycycle = IR_CARRIER_DUTYCYCLE;
+    PulsePairs pulsepairs;
+    Py_buffer view;
+    PyObject *tab;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "OI|ff", &tab, &gpio, &frequency, &dutycycle))
+        return NULL;
+    if (frequency < 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "frequency must be 0.0 (no carrier) or greater");
+        return NULL;
     }
-//    printf("data formaté\n");
-    for (i = 0; i < size; i++) {
-        gpio_pulsepause(gpio, pulsepairs->pairs[i][0], pulsepairs->pairs[i][1], &pair);
- //       printf("code %d : pulse %ld us (%ld), pause %ld us (%ld)\n", i, pair.pulse, pulsepairs[i][0], pair.pause,  pulsepairs[i][1]);
-        pulsepairs->pairs[i][0] = pair.pulse;
-        pulsepairs->pairs[i][1] = pair.pause;
+    if (dutycycle <= 0.0 || dutycycle > 100.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "dutycycle must have a value from 0.0 to 100.0");
+        return NULL;
     }
-    
-    PyObject *Result=PyList_New(size);
-    PyObject *ItemR=PyList_New(2);
-    
-    for (i = 0; i < size; i++) {
-        PyList_SetItem(ItemR, 0, PyInt_FromLong(pulsepairs->pairs[i][0]));
-        PyList_SetItem(ItemR, 1, PyInt_FromLong(pulsepairs->pairs[i][1]));
-        PyList_SetItem(Result, i, PyList_AsTuple(ItemR));
+
+    if (pulsepairs_from_object(tab, &pulsepairs, &view) != 0)
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    result = dma_ir_send(gpio, &pulsepairs, frequency, dutycycle);
+    Py_END_ALLOW_THREADS
+    pulsepairs_release(&pulsepairs, &view);
+
+    switch (result) {
+    case DMA_IR_OK:
+        Py_RETURN_NONE;
+    case DMA_IR_NOT_MAPPED:
+        PyErr_SetString(PyExc_RuntimeError, "DMA not available for this gpio (run as root, gpio 0 to 31 without PWM carrier)");
+        return NULL;
+    case DMA_IR_MEM_FAIL:
+        PyErr_SetString(PyExc_RuntimeError, "Unable to allocate locked DMA memory");
+        return NULL;
+    case DMA_IR_PWM_BUSY:
+        PyErr_SetString(PyExc_RuntimeError, "A PWM channel needed by the DMA send or its clock is used by a PWM2835");
+        return NULL;
+    default:
+        PyErr_SetString(PyExc_RuntimeError, "DMA transfer timed out");
+        return NULL;
     }
-    free_plusepairs(pulsepairs);
-    return Result;
 }
 
-// python method PWM.BCMWatchPulsePairsGPIO(self, gpio)
+// python method PWM.BCMWatchPulsePairsGPIO(self, gpio, capacity=PULSEPAIR_DEFAULTCAPACITY)
 static PyObject *py_bcm2835_WatchPulsePairs(PyObject *self, PyObject *args)
 {
-    int i, size;
     unsigned int gpio;
-    PulsePairs *pulsepairs = NULL;
+    unsigned int capacity = PULSEPAIR_DEFAULTCAPACITY;
+    PulsePairs pulsepairs;
+    PyObject *result;
 
-//    printf("****** receivePulsePairs  ? ******\n");
-    if (!PyArg_ParseTuple(args, "i", &gpio)) {
-        printf("--- error parsed tuple");
+    if (!PyArg_ParseTuple(args, "i|I", &gpio, &capacity)) {
         PyErr_SetString(PyExc_ValueError,  " +++ error parsetuple");
         return NULL;
     };
-    pulsepairs = malloc(sizeof(PulsePairs));
-    if (gpio_watchpulsepairs(gpio, pulsepairs)) {
-        printf("code received :)\n");
-        size = num_pulsepairs(pulsepairs);
-        PyObject *Result=PyList_New(size);
-        PyObject *ItemR=PyList_New(2);
-        
-        for (i = 0; i < size; i++) {
-            PyList_SetItem(ItemR, 0, PyInt_FromLong(pulsepairs->pairs[i][0]));
-            PyList_SetItem(ItemR, 1, PyInt_FromLong(pulsepairs->pairs[i][1]));
-            PyList_SetItem(Result, i, PyList_AsTuple(ItemR));
+    // buffer is sized before watching, so the capture loop does not allocate
+    if (init_pulsepairs(&pulsepairs, capacity) != 0)
+        return PyErr_NoMemory();
+    // a running capture gives the frame without polling, unless called from an event callback
+    if (ir_capture_active(gpio) && !event_thread_current()) {
+        int frame;
+        Py_BEGIN_ALLOW_THREADS
+        frame = ir_capture_frame(gpio, &pulsepairs, PULSEPAIR_TIMEOUTSTAGE / 1000);
+        Py_END_ALLOW_THREADS
+        if (frame == IR_FRAME_OK) {
+            result = pulsepairs_to_list(&pulsepairs);
+            free_plusepairs(&pulsepairs);
+            return result;
         }
-        free_plusepairs(pulsepairs);
-        return Result;
-    } else {
-        free(pulsepairs);
+    } else if (gpio_watchpulsepairs(gpio, &pulsepairs)) {
+        result = pulsepairs_to_list(&pulsepairs);
+        free_plusepairs(&pulsepairs);
+        return result;
     };
+    free_plusepairs(&pulsepairs);
+    Py_RETURN_NONE;
+}
+
+// python function BCMCaptureIR(gpio, timeout=PULSEPAIR_TIMEOUTSTAGE)
+static PyObject *py_bcm2835_CaptureIR(PyObject *self, PyObject *args)
+{
+    unsigned int gpio;
+    unsigned int timeout = PULSEPAIR_TIMEOUTSTAGE;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "I|I", &gpio, &timeout))
+        return NULL;
+    if (gpio >= 54) {
+        PyErr_SetString(PyExc_ValueError, "The gpio must be 0 to 53");
+        return NULL;
+    }
+    if (timeout == 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be greater than 0");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = ir_capture_start(gpio, timeout);
+    Py_END_ALLOW_THREADS
+    if (result == IR_CAPTURE_STARTED) {
+        PyErr_SetString(PyExc_RuntimeError, "IR capture already started on this gpio");
+        return NULL;
+    } else if (result == IR_CAPTURE_EDGE) {
+        PyErr_SetString(PyExc_RuntimeError, "Edge detection on this gpio must be BOTH to capture IR");
+        return NULL;
+    } else if (result != IR_CAPTURE_OK) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to add edge detection");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// python function BCMReadIR(gpio, wait=-1)
+static PyObject *py_bcm2835_ReadIR(PyObject *self, PyObject *args)
+{
+    unsigned int gpio;
+    int wait_ms = -1;
+    int frame;
+    PulsePairs pulsepairs;
+    PyObject *result;
+
+    if (!PyArg_ParseTuple(args, "I|i", &gpio, &wait_ms))
+        return NULL;
+    if (event_thread_current()) {
+        PyErr_SetString(PyExc_RuntimeError, "BCMReadIR can not be called from an event callback");
+        return NULL;
+    }
+    if (init_pulsepairs(&pulsepairs, PULSEPAIR_DEFAULTCAPACITY) != 0)
+        return PyErr_NoMemory();
+
+    Py_BEGIN_ALLOW_THREADS
+    frame = ir_capture_frame(gpio, &pulsepairs, wait_ms);
+    Py_END_ALLOW_THREADS
+
+    if (frame == IR_FRAME_OK) {
+        result = pulsepairs_to_list(&pulsepairs);
+    } else if (frame == IR_FRAME_NONE) {
+        Py_INCREF(Py_None);
+        result = Py_None;
+    } else if (frame == IR_FRAME_MEM_FAIL) {
+        result = PyErr_NoMemory();
+    } else {
+        PyErr_SetString(PyExc_RuntimeError, "No IR capture on this gpio, use BCMCaptureIR first");
+        result = NULL;
+    }
+    free_plusepairs(&pulsepairs);
+    return result;
+}
+
+// python function BCMStopIR(gpio)
+static PyObject *py_bcm2835_StopIR(PyObject *self, PyObject *args)
+{
+    unsigned int gpio;
+
+    if (!PyArg_ParseTuple(args, "I", &gpio))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    ir_capture_stop(gpio);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -814,16 +1582,28 @@ static const char moduledocstring[] = "GPIO functionality of a Raspberry Pi usin
 PyMethodDef rpi_gpio_methods[] = {
    {"setup", (PyCFunction)py_setup_channel, METH_VARARGS | METH_KEYWORDS, "Set up the GPIO channel, direction and (optional) pull/up down control\nchannel        - either board pin number or BCM number depending on which mode is set.\ndirection      - INPUT or OUTPUT\n[pull_up_down] - PUD_OFF (default), PUD_UP or PUD_DOWN\n[initial]      - Initial value for an output channel"},
    {"cleanup", (PyCFunction)py_cleanup, METH_VARARGS | METH_KEYWORDS, "Clean up by resetting all GPIO channels that have been used by this program to INPUT with no pullup/pulldown and no event detection\n[channel] - individual channel to clean up.  Default - clean every channel that has been used."},
-   {"output", py_output_gpio, METH_VARARGS, "Output to a GPIO channel\nchannel - either board pin number or BCM number depending on which mode is set.\nvalue   - 0/1 or False/True or LOW/HIGH"},
-   {"input", py_input_gpio, METH_VARARGS, "Input from a GPIO channel.  Returns HIGH=1=True or LOW=0=False\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"output", py_output_gpio, METH_VARARGS, "Output to a GPIO channel or a list of channels, changed together\nchannel - either board pin number or BCM number depending on which mode is set, or a list/tuple of them\nvalue   - 0/1 or False/True or LOW/HIGH, or a list/tuple of values, one per channel"},
+   {"input", py_input_gpio, METH_VARARGS, "Input from a GPIO channel.  Returns HIGH=1=True or LOW=0=False\nchannel - either board pin number or BCM number depending on which mode is set, or a list/tuple of them read together (returns a list)"},
    {"setmode", py_setmode, METH_VARARGS, "Set up numbering mode to use for channels.\nBOARD - Use Raspberry Pi board numbers\nBCM   - Use Broadcom GPIO 00..nn numbers"},
    {"add_event_detect", (PyCFunction)py_add_event_detect, METH_VARARGS | METH_KEYWORDS, "Enable edge detection events for a particular GPIO channel.\nchannel      - either board pin number or BCM number depending on which mode is set.\nedge         - RISING, FALLING or BOTH\n[callback]   - A callback function for the event (optional)\n[bouncetime] - Switch bounce timeout in ms for callback"},
    {"remove_event_detect", py_remove_event_detect, METH_VARARGS, "Remove edge detection for a particular GPIO channel\nchannel - either board pin number or BCM number depending on which mode is set."},
    {"event_detected", py_event_detected, METH_VARARGS, "Returns True if an edge has occured on a given GPIO.  You need to enable edge detection using add_event_detect() first.\nchannel - either board pin number or BCM number depending on which mode is set."},
+   {"read_edges", (PyCFunction)py_read_edges, METH_VARARGS | METH_KEYWORDS, "Return the edges recorded since the last call as a list of (timestamp_ns, level), oldest first.  You need to enable edge detection using add_event_detect() first.\nchannel - either board pin number or BCM number depending on which mode is set.\n[max]   - maximum number of edges returned (default 4096)"},
+   {"set_event_backend", (PyCFunction)py_set_event_backend, METH_VARARGS | METH_KEYWORDS, "Select how edges are detected by add_event_detect(), only while no edge detection is in use\nbackend - EVENT_SYSFS (default) : /sys/class/gpio files\n          EVENT_CDEV : gpio character device with kernel timestamps, needs a build against kernel headers 5.10 or newer\n          EVENT_REGS : GPIO event detect registers polled by a thread, for pins without kernel interrupts\n[chip]  - character device of the gpios (default /dev/gpiochip0)"},
+   {"set_realtime", (PyCFunction)py_set_realtime, METH_VARARGS | METH_KEYWORDS, "Run the timing critical threads and calls under a real-time policy\npolicy        - SCHED_FIFO or SCHED_RR, SCHED_OTHER turns it off\n[priority]    - priority of the policy, 1 to 99 (default 0 for SCHED_OTHER)\n[cpu]         - core to pin them to, -1 (default) for none\n[lock_memory] - lock the process memory with mlockall() against page faults (default False)\n[scope]       - REALTIME_THREADS : event poll, software PWM and ramp threads, running or started afterwards\n                REALTIME_CALLS : pulse/pause send and watch and waveforms, restored when they return\n                (default both)"},
+   {"ChangeDutyCycleBulk", py_change_duty_cycle_bulk, METH_VARARGS, "Change the duty cycle of several software PWM channels at once, each from its next period\npwms - list or tuple of PWM objects\ndutycycles - one dutycycle between 0.0 and 100.0 for all, or a list or tuple of one per PWM object"},
+   {"set_trace", py_set_trace, METH_VARARGS, "Enable or disable the binary trace of timing events, off by default\nenable - True records TRACE_* events in a ring buffer instead of printing them, dropping older records"},
+   {"read_trace", (PyCFunction)py_read_trace, METH_VARARGS | METH_KEYWORDS, "Read the trace records since the last call, oldest first, as a list of (timestamp, event, arg)\ntimestamp - CLOCK_MONOTONIC time in ns\nevent     - TRACE_* constant\n[max]     - maximum number of records returned (default all)"},
+   {"set_debounce", py_set_debounce, METH_VARARGS, "Set the switch debounce of a channel with edge detection, on the edge timestamps\nchannel - either board pin number or BCM number depending on which mode is set.\nmode    - DEBOUNCE_IGNORE : ignore edges for time after the last accepted one (as bouncetime)\n          DEBOUNCE_STABLE : accept an edge once the level did not change for time\ntime    - time in us, 0 disables debounce"},
+   {"set_regpoll_interval", py_set_regpoll_interval, METH_VARARGS, "Set the time the EVENT_REGS thread sleeps between two polls of the event detect registers\ninterval - time in us (default 10), 0 polls continuously"},
+   {"set_event_batch", py_set_event_batch, METH_VARARGS, "Set how many ready channels the event thread handles per wakeup\nsize - 1 to 55 (default 16)"},
+   {"event_stats", (PyCFunction)py_event_stats, METH_VARARGS | METH_KEYWORDS, "Return the event thread counters as a dict : wakeups, events and max_batch (largest number of events in one wakeup)\n[reset] - reset the counters after reading them"},
    {"add_event_callback", (PyCFunction)py_add_event_callback, METH_VARARGS | METH_KEYWORDS, "Add a callback for an event already defined using add_event_detect()\nchannel      - either board pin number or BCM number depending on which mode is set.\ncallback     - a callback function"},
    {"wait_for_edge", py_wait_for_edge, METH_VARARGS, "Wait for an edge.\nchannel - either board pin number or BCM number depending on which mode is set.\nedge    - RISING, FALLING or BOTH"},
    {"gpio_function", py_gpio_function, METH_VARARGS, "Return the current GPIO function (IN, OUT, PWM, SERIAL, I2C, SPI)\nchannel - either board pin number or BCM number depending on which mode is set."},
    {"setwarnings", py_setwarnings, METH_VARARGS, "Enable or disable warning messages"},
+   {"set_callback_dispatch", py_set_callback_dispatch, METH_VARARGS, "Select how event callbacks are run\nbatch - False (default) : each callback runs in the event thread as the edge is seen\n        True : edges are queued and a dispatcher thread runs all pending callbacks under one GIL acquisition"},
+   {"set_callback_window", py_set_callback_window, METH_VARARGS, "Set the coalescing window of batched callbacks for a channel\nchannel - either board pin number or BCM number depending on which mode is set.\nwindow  - time in us, callbacks of the channel run at most once per window for all the edges seen in it.  0 (default) runs them once per edge"},
    {"BCMInit", py_BCM2835_init, METH_VARARGS, "BCM2835 Initialize."},
    {"BCMClose", py_PWM2835_close, METH_VARARGS, "BCM2835 close all channel."},
    {"BCMsetModeGPIO", py_bcm2835_setmode, METH_VARARGS, "BCM2835 set GPIO mode input or output."},
@@ -833,8 +1613,15 @@ PyMethodDef rpi_gpio_methods[] = {
    {"BCMWaitPullEventGPIO", py_bcm2835_waitpull_gpio, METH_VARARGS, "BCM2835 wait pull event on output GPIO."},
    {"BCMWriteGPIO", py_bcm2835_output_gpio, METH_VARARGS, "BCM2835 Write on output GPIO."},
    {"BCMReadGPIO", py_bcm2835_input_gpio, METH_VARARGS, "BCM2835 Read on output or input GPIO."},
-   {"BCMPulsePairsGPIO", py_bcm2835_sendPulsePairs, METH_VARARGS, "BCM2835 write pulse/pause pairs on output GPIO."},
-   {"BCMWatchPulsePairsGPIO", py_bcm2835_WatchPulsePairs, METH_VARARGS, "BCM2835 watch for pulse/pause pairs on input GPIO."},
+   {"BCMWriteMask", py_bcm2835_write_mask, METH_VARARGS, "BCM2835 Write several output GPIOs 0 to 31 at once.\nvalue - bit n is the level of GPIO n\nmask  - bit n set to change GPIO n"},
+   {"BCMReadLevels", py_bcm2835_read_levels, METH_NOARGS, "BCM2835 Read the levels of all GPIOs at once.\nReturn (GPLEV0, GPLEV1) : bit n of GPLEV0 is GPIO n, bit n of GPLEV1 is GPIO 32+n"},
+   {"BCMPlayWaveform", py_bcm2835_play_waveform, METH_VARARGS, "BCM2835 play a timed sequence of GPIOs 0 to 31 masks on absolute system timer deadlines (1 us resolution).\nsteps - list of (set_mask, clr_mask, delay_ns) : bits of set_mask go high then bits of clr_mask go low, the next step is due delay_ns later\n[priority] - SCHED_FIFO priority for the duration of the play, 0 (default) keeps the current policy\n[cpu] - core to pin the play to, -1 (default) for none\nReturn (max_late, mean_late, late_steps, drift) : largest and mean lateness in us of the late steps against their deadlines, number of late steps, and lateness of the end of the last delay."},
+   {"BCMPulsePairsGPIO", py_bcm2835_sendPulsePairs, METH_VARARGS, "BCM2835 write pulse/pause pairs on output GPIO.\npairs - list of [pulse, pause] or flat pulse/pause uint32 buffer (array('I'), numpy.uint32)\ngpio  - BCM gpio number\n[frequency] - carrier frequency in Hz (default 38000.0), made by the PWM peripheral on gpio 12, 13, 18, 19\n[dutycycle] - carrier duty cycle (0.0 to 100.0, default 50.0)\nReturn (jitter, drift) : per pair lateness in us of the pulse and pause edges, and drift in us of the frame end."},
+   {"BCMPulsePairsDMA", py_bcm2835_sendPulsePairsDMA, METH_VARARGS, "BCM2835 write pulse/pause pairs on output GPIO with DMA, durations rounded to 5 us.\npairs - list of [pulse, pause] or flat pulse/pause uint32 buffer (array('I'), numpy.uint32)\ngpio  - BCM gpio number\n[frequency] - carrier frequency in Hz (default 38000.0, 0.0 for none), made by the PWM peripheral on gpio 12, 13, 18, 19, other gpios (0 to 31) are gated without carrier\n[dutycycle] - carrier duty cycle (0.0 to 100.0, default 50.0)"},
+   {"BCMWatchPulsePairsGPIO", py_bcm2835_WatchPulsePairs, METH_VARARGS, "BCM2835 watch for pulse/pause pairs on input GPIO.\ngpio       - BCM gpio number\n[capacity] - number of pairs preallocated for the capture"},
+   {"BCMCaptureIR", py_bcm2835_CaptureIR, METH_VARARGS, "BCM2835 start recording the edges of an IR receiver on input GPIO, in the background without polling.\ngpio      - BCM gpio number\n[timeout] - gap in us ending a frame (default 65000)"},
+   {"BCMReadIR", py_bcm2835_ReadIR, METH_VARARGS, "BCM2835 read the next IR frame recorded by BCMCaptureIR, as a list of (pulse, pause) in us.\ngpio   - BCM gpio number\n[wait] - time in ms to wait for the frame start, -1 (default) waits forever\nReturn None if no frame started within wait."},
+   {"BCMStopIR", py_bcm2835_StopIR, METH_VARARGS, "BCM2835 stop the IR capture started by BCMCaptureIR. A BCMReadIR waiting on the gpio gets the frame in progress, cut at the last recorded edge, if it holds enough pairs. Edges no reader is waiting for are dropped.\ngpio - BCM gpio number"},
    {NULL, NULL, 0, NULL}
 };
 
@@ -865,6 +1652,7 @@ PyMODINIT_FUNC initGPIO(void)
 #endif
 
    define_constants(module);
+   dispatch_init();
 
    // detect board revision and set up accordingly
    revision = get_rpi_revision();
@@ -896,7 +1684,16 @@ PyMODINIT_FUNC initGPIO(void)
    Py_INCREF(&PWMType);
    PyModule_AddObject(module, "PWM", (PyObject*)&PWMType);
 
-   printf("Py_INCREF 2 allocation\n");
+   // Add PWMGroup class
+   if (PWMGroup_init_Type() == NULL)
+#if PY_MAJOR_VERSION > 2
+      return NULL;
+#else
+      return;
+#endif
+   Py_INCREF(&PWMGroupType);
+   PyModule_AddObject(module, "PWMGroup", (PyObject*)&PWMGroupType);
+
    // Add PWM2835 class
    if (PWM2835_init_PWMType() == NULL)
 #if PY_MAJOR_VERSION > 2
@@ -907,6 +1704,25 @@ PyMODINIT_FUNC initGPIO(void)
    Py_INCREF(&PWM2835Type);
    PyModule_AddObject(module, "PWM2835", (PyObject*)&PWM2835Type);
 
+   // Add IRWaveform class
+   if (IRWaveform_init_Type() == NULL)
+#if PY_MAJOR_VERSION > 2
+      return NULL;
+#else
+      return;
+#endif
+   Py_INCREF(&IRWaveformType);
+   PyModule_AddObject(module, "IRWaveform", (PyObject*)&IRWaveformType);
+
+   if (Pin_init_Type() == NULL)
+#if PY_MAJOR_VERSION > 2
+      return NULL;
+#else
+      return;
+#endif
+   Py_INCREF(&PinType);
+   PyModule_AddObject(module, "Pin", (PyObject*)&PinType);
+
    
    if (!PyEval_ThreadsInitialized())
       PyEval_InitThreads();
@@ -923,6 +1739,17 @@ PyMODINIT_FUNC initGPIO(void)
 #endif
    }
 
+   if (Py_AtExit(dispatch_exit) != 0)
+   {
+      setup_error = 1;
+      cleanup();
+#if PY_MAJOR_VERSION > 2
+      return NULL;
+#else
+      return;
+#endif
+   }
+
    if (Py_AtExit(event_cleanup_all) != 0)
    {
       setup_error = 1;
@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2013 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "Python.h"
+#include "c_gpio.h"
+#include "common.h"
+#include "constants.h"
+#include "py_pin.h"
+
+#include "bcm2835.h"
+
+typedef struct
+{
+    PyObject_HEAD
+    GpioPin pin;        // register pointers and mask resolved at construction
+    int direction;      // INPUT or OUTPUT as set up when the Pin was created, -1 until __init__ ran
+} PinObject;
+
+// python method Pin.__new__(type), the pin stays unusable until __init__ resolves it
+static PyObject *Pin_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PinObject *self;
+
+    if ((self = (PinObject *)type->tp_alloc(type, 0)) != NULL)
+        self->direction = -1;
+    return (PyObject *)self;
+}
+
+// python method Pin.__init__(self, channel, direction=None, pull_up_down=PUD_OFF, initial=None)
+// Without direction the channel must already have been set up with setup().
+static int Pin_init(PinObject *self, PyObject *args, PyObject *kwds)
+{
+    int channel;
+    int direction = -1;
+    int pud = PUD_OFF + PY_PUD_CONST_OFFSET;
+    int initial = -1;
+    unsigned int gpio;
+    static char *kwlist[] = {"channel", "direction", "pull_up_down", "initial", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|iii", kwlist, &channel, &direction, &pud, &initial))
+        return -1;
+
+    if (direction != -1)
+    {
+        if (setup_channel(channel, direction, pud, initial, &gpio))
+            return -1;
+    } else {
+        if (get_gpio_number(channel, &gpio))
+            return -1;
+
+        if (gpio_direction[gpio] != INPUT && gpio_direction[gpio] != OUTPUT)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel first");
+            return -1;
+        }
+    }
+
+    pin_init(&self->pin, gpio);
+    self->direction = gpio_direction[gpio];
+    return 0;
+}
+
+static int check_init(PinObject *self)
+{
+    if (self->direction == -1)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The Pin has not been initialised");
+        return 0;
+    }
+    return 1;
+}
+
+static int check_output(PinObject *self)
+{
+    if (!check_init(self))
+        return 0;
+    // the channel may have been cleaned up or set up again since the Pin was made
+    if (self->direction != OUTPUT || gpio_direction[self->pin.gpio] != OUTPUT)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "The GPIO channel has not been set up as an OUTPUT");
+        return 0;
+    }
+    return 1;
+}
+
+// python method Pin.write(self, value)
+static PyObject *Pin_write(PinObject *self, PyObject *args)
+{
+    int value;
+
+    if (!PyArg_ParseTuple(args, "i", &value))
+        return NULL;
+
+    if (!check_output(self))
+        return NULL;
+
+    PIN_WRITE(&self->pin, value);
+    Py_RETURN_NONE;
+}
+
+// python method Pin.read(self)
+static PyObject *Pin_read(PinObject *self, PyObject *args)
+{
+    if (!check_init(self))
+        return NULL;
+
+    return Py_BuildValue("i", PIN_READ(&self->pin) ? HIGH : LOW);
+}
+
+// python method Pin.toggle(self)
+static PyObject *Pin_toggle(PinObject *self, PyObject *args)
+{
+    if (!check_output(self))
+        return NULL;
+
+    PIN_WRITE(&self->pin, !PIN_READ(&self->pin));
+    Py_RETURN_NONE;
+}
+
+// python method Pin.pulse(self, us, value=HIGH)
+static PyObject *Pin_pulse(PinObject *self, PyObject *args)
+{
+    unsigned int us;
+    int value = HIGH;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "I|i", &us, &value))
+        return NULL;
+
+    if (!check_output(self))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = pin_pulse(&self->pin, value, us);
+    Py_END_ALLOW_THREADS
+    if (result)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to map the system timer");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// python property Pin.value
+static PyObject *Pin_getvalue(PinObject *self, void *closure)
+{
+    if (!check_init(self))
+        return NULL;
+
+    return Py_BuildValue("i", PIN_READ(&self->pin) ? HIGH : LOW);
+}
+
+static int Pin_setvalue(PinObject *self, PyObject *value, void *closure)
+{
+    int level;
+
+    if (value == NULL)
+    {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete the value attribute");
+        return -1;
+    }
+
+    level = PyObject_IsTrue(value);
+    if (level < 0 || !check_output(self))
+        return -1;
+
+    PIN_WRITE(&self->pin, level);
+    return 0;
+}
+
+static PyMethodDef
+Pin_methods[] = {
+   { "write", (PyCFunction)Pin_write, METH_VARARGS, "Output to the pin\nvalue - 0/1 or False/True or LOW/HIGH" },
+   { "read", (PyCFunction)Pin_read, METH_NOARGS, "Input from the pin.  Returns HIGH=1=True or LOW=0=False" },
+   { "toggle", (PyCFunction)Pin_toggle, METH_NOARGS, "Invert the output level of the pin" },
+   { "pulse", (PyCFunction)Pin_pulse, METH_VARARGS, "Output a pulse timed on the system timer\nus - pulse width in us\nvalue - level of the pulse, the pin is left at the opposite level [default HIGH]" },
+   { NULL }
+};
+
+static PyGetSetDef
+Pin_getset[] = {
+   { "value", (getter)Pin_getvalue, (setter)Pin_setvalue, "Level of the pin, HIGH or LOW.  Only writable for an OUTPUT", NULL },
+   { NULL }
+};
+
+PyTypeObject PinType = {
+   PyVarObject_HEAD_INIT(NULL,0)
+   "RPi.GPIO.Pin",            // tp_name
+   sizeof(PinObject),         // tp_basicsize
+   0,                         // tp_itemsize
+   0,                         // tp_dealloc
+   0,                         // tp_print
+   0,                         // tp_getattr
+   0,                         // tp_setattr
+   0,                         // tp_compare
+   0,                         // tp_repr
+   0,                         // tp_as_number
+   0,                         // tp_as_sequence
+   0,                         // tp_as_mapping
+   0,                         // tp_hash
+   0,                         // tp_call
+   0,                         // tp_str
+   0,                         // tp_getattro
+   0,                         // tp_setattro
+   0,                         // tp_as_buffer
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, // tp_flag
+   "GPIO channel resolved once to its registers for fast read/write", // tp_doc
+   0,                         // tp_traverse
+   0,                         // tp_clear
+   0,                         // tp_richcompare
+   0,                         // tp_weaklistoffset
+   0,                         // tp_iter
+   0,                         // tp_iternext
+   Pin_methods,               // tp_methods
+   0,                         // tp_members
+   Pin_getset,                // tp_getset
+   0,                         // tp_base
+   0,                         // tp_dict
+   0,                         // tp_descr_get
+   0,                         // tp_descr_set
+   0,                         // tp_dictoffset
+   (initproc)Pin_init,        // tp_init
+   0,                         // tp_alloc
+   0,                         // tp_new
+};
+
+PyTypeObject *Pin_init_Type(void)
+{
+   // Fill in some slots in the type, and make it ready
+   PinType.tp_new = Pin_new;
+   if (PyType_Ready(&PinType) < 0)
+      return NULL;
+
+   return &PinType;
+}
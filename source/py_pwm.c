@@ -21,10 +21,13 @@ SOFTWARE.
 */
 
 #include "Python.h"
+#include "structmember.h"
 #include "soft_pwm.h"
 #include "py_pwm.h"
-#include "common.h"
 #include "c_gpio.h"
+#include "common.h"
+#include "trace.h"
+#include "pwm_ramp.h"
 
 #include "bcm2835.h"
 
@@ -47,7 +50,19 @@ typedef struct
     float freq;
     unsigned int divider;
     unsigned int range;
+    int initialised;    // channel is only this object's once __init__ succeeded
 } PWM2835Object;
+
+typedef struct
+{
+    PyObject_HEAD
+    PulsePairs pulsepairs;      // validated pulse/pause durations in us
+    PulsePairs measured;        // preallocated per edge jitter report of the last transmit
+    float level;                // carrier level in % of PWM range
+    unsigned long long duration; // whole frame duration in us
+    unsigned int cached_range;  // PWM range the cached data was computed for
+    unsigned int cached_data;   // PWM data giving level for cached_range
+} IRWaveformObject;
  
 // python method PWM.__init__(self, channel, frequency)
 static int PWM_init(PWMObject *self, PyObject *args, PyObject *kwds)
@@ -119,6 +134,73 @@ static PyObject *PWM_ChangeDutyCycle(PWMObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+// python function ChangeDutyCycleBulk(pwms, dutycycles)
+PyObject *py_change_duty_cycle_bulk(PyObject *self, PyObject *args)
+{
+    PyObject *pwms, *dutycycles, *seq = NULL, *dseq = NULL, *item;
+    PWMObject *pwm;
+    unsigned int gpios[54];
+    float duty[54];
+    Py_ssize_t i, size;
+
+    if (!PyArg_ParseTuple(args, "OO", &pwms, &dutycycles))
+        return NULL;
+
+    if ((seq = PySequence_Fast(pwms, "pwms must be a list or tuple of PWM objects")) == NULL)
+        return NULL;
+    size = PySequence_Fast_GET_SIZE(seq);
+    if (size > 54)
+    {
+        PyErr_SetString(PyExc_ValueError, "Too many PWM objects");
+        goto fail;
+    }
+    // sequences first : a numpy array also passes PyNumber_Check
+    if (PySequence_Check(dutycycles))
+    {
+        if ((dseq = PySequence_Fast(dutycycles, "dutycycles must be a number or a list or tuple of them")) == NULL)
+            goto fail;
+        if (PySequence_Fast_GET_SIZE(dseq) != size)
+        {
+            PyErr_SetString(PyExc_ValueError, "One dutycycle per PWM object is needed");
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        item = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyObject_TypeCheck(item, &PWMType))
+        {
+            PyErr_SetString(PyExc_TypeError, "pwms must be a list or tuple of PWM objects");
+            goto fail;
+        }
+        gpios[i] = ((PWMObject *)item)->gpio;
+        duty[i] = (float)PyFloat_AsDouble(dseq == NULL ? dutycycles : PySequence_Fast_GET_ITEM(dseq, i));
+        if (PyErr_Occurred())
+            goto fail;
+        if (duty[i] < 0.0 || duty[i] > 100.0)
+        {
+            PyErr_SetString(PyExc_ValueError, "dutycycle must have a value from 0.0 to 100.0");
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        pwm = (PWMObject *)PySequence_Fast_GET_ITEM(seq, i);
+        pwm->dutycycle = duty[i];
+    }
+    pwm_set_duty_cycle_bulk(gpios, duty, size);
+    Py_DECREF(seq);
+    Py_XDECREF(dseq);
+    Py_RETURN_NONE;
+
+fail:
+    Py_DECREF(seq);
+    Py_XDECREF(dseq);
+    return NULL;
+}
+
 // python method PWM. ChangeFrequency(self, frequency)
 static PyObject *PWM_ChangeFrequency(PWMObject *self, PyObject *args)
 {
@@ -139,6 +221,22 @@ static PyObject *PWM_ChangeFrequency(PWMObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+// python method PWM.ChangeResolution(self, bits)
+static PyObject *PWM_ChangeResolution(PWMObject *self, PyObject *args)
+{
+    unsigned int bits;
+
+    if (!PyArg_ParseTuple(args, "I", &bits))
+        return NULL;
+
+    if (pwm_set_resolution(self->gpio, bits) != 0)
+    {
+        PyErr_Format(PyExc_ValueError, "resolution must be 1 to %d bits", PWM_MAX_RESOLUTION);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
 // python function PWM.stop(self)
 static PyObject *PWM_stop(PWMObject *self, PyObject *args)
 {
@@ -158,6 +256,7 @@ PWM_methods[] = {
    { "start", (PyCFunction)PWM_start, METH_VARARGS, "Start software PWM\ndutycycle - the duty cycle (0.0 to 100.0)" },
    { "ChangeDutyCycle", (PyCFunction)PWM_ChangeDutyCycle, METH_VARARGS, "Change the duty cycle\ndutycycle - between 0.0 and 100.0" },
    { "ChangeFrequency", (PyCFunction)PWM_ChangeFrequency, METH_VARARGS, "Change the frequency\nfrequency - frequency in Hz (freq > 1.0)" },
+   { "ChangeResolution", (PyCFunction)PWM_ChangeResolution, METH_VARARGS, "Change the duty cycle resolution\nbits - 2^bits duty cycle steps per period, 1 to 16 (default 10)" },
    { "stop", (PyCFunction)PWM_stop, METH_VARARGS, "Stop software PWM" },
    { NULL }
 };
@@ -214,6 +313,439 @@ PyTypeObject *PWM_init_PWMType(void)
    return &PWMType;
 }
 
+typedef struct
+{
+    PyObject_HEAD
+    int group;              // soft_pwm group index + 1, 0 when not created
+    unsigned int size;
+    float freq;
+} PWMGroupObject;
+
+// python method PWMGroup.__init__(self, channels, frequency, phases=None)
+static int PWMGroup_init(PWMGroupObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *channels, *phases = Py_None;
+    PyObject *seq, *phase_seq = NULL;
+    unsigned int gpios[54];
+    float phase[54];
+    float frequency;
+    Py_ssize_t i, size;
+    int group;
+    static char *kwlist[] = {"channels", "frequency", "phases", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Of|O", kwlist, &channels, &frequency, &phases))
+        return -1;
+
+    if (frequency <= 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "frequency must be greater than 0.0");
+        return -1;
+    }
+
+    if ((seq = PySequence_Fast(channels, "channels must be a list or tuple")) == NULL)
+        return -1;
+    size = PySequence_Fast_GET_SIZE(seq);
+    if (size == 0 || size > 54)
+    {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "A group needs 1 to 54 channels");
+        return -1;
+    }
+    if (phases != Py_None)
+    {
+        if ((phase_seq = PySequence_Fast(phases, "phases must be a list or tuple")) == NULL)
+            goto error;
+        if (PySequence_Fast_GET_SIZE(phase_seq) != size)
+        {
+            PyErr_SetString(PyExc_ValueError, "One phase per channel is needed");
+            goto error;
+        }
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        long channel = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (PyErr_Occurred() || get_gpio_number((int)channel, &gpios[i]))
+            goto error;
+        // ensure channel set as output
+        if (gpio_direction[gpios[i]] != OUTPUT)
+        {
+            PyErr_SetString(PyExc_RuntimeError, "You must setup() the GPIO channel as an output first");
+            goto error;
+        }
+        phase[i] = 0.0;
+        if (phase_seq != NULL)
+        {
+            phase[i] = (float)PyFloat_AsDouble(PySequence_Fast_GET_ITEM(phase_seq, i));
+            if (PyErr_Occurred())
+                goto error;
+            if (phase[i] < 0.0 || phase[i] >= 100.0)
+            {
+                PyErr_SetString(PyExc_ValueError, "phase must have a value from 0.0 to less than 100.0");
+                goto error;
+            }
+        }
+    }
+    Py_DECREF(seq);
+    Py_XDECREF(phase_seq);
+
+    // free the previous group first, it may hold the same channels
+    if (self->group)
+    {
+        pwm_group_free(self->group - 1);
+        self->group = 0;
+    }
+    if ((group = pwm_group_create(gpios, phase, (unsigned int)size, frequency)) < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "A channel is already used by software PWM, or too many groups");
+        return -1;
+    }
+    self->group = group + 1;
+    self->size = (unsigned int)size;
+    self->freq = frequency;
+    return 0;
+
+error:
+    Py_DECREF(seq);
+    Py_XDECREF(phase_seq);
+    return -1;
+}
+
+// Set the duty cycles of the group from a number for all channels or a sequence of one per channel
+static int PWMGroup_set_duty_cycles(PWMGroupObject *self, PyObject *dutycycles)
+{
+    PyObject *seq;
+    float duty[54];
+    unsigned int i;
+
+    // sequences first : a numpy array also passes PyNumber_Check
+    if (PySequence_Check(dutycycles))
+    {
+        if ((seq = PySequence_Fast(dutycycles, "dutycycle must be a number or a list or tuple of them")) == NULL)
+            return -1;
+        if (PySequence_Fast_GET_SIZE(seq) != self->size)
+        {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_ValueError, "One dutycycle per channel is needed");
+            return -1;
+        }
+        for (i = 0; i < self->size; i++)
+            duty[i] = (float)PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+        Py_DECREF(seq);
+        if (PyErr_Occurred())
+            return -1;
+    } else {
+        duty[0] = (float)PyFloat_AsDouble(dutycycles);
+        if (PyErr_Occurred())
+            return -1;
+        for (i = 1; i < self->size; i++)
+            duty[i] = duty[0];
+    }
+
+    for (i = 0; i < self->size; i++)
+    {
+        if (duty[i] < 0.0 || duty[i] > 100.0)
+        {
+            PyErr_SetString(PyExc_ValueError, "dutycycle must have a value from 0.0 to 100.0");
+            return -1;
+        }
+    }
+    pwm_group_set_duty_cycles(self->group - 1, duty);
+    return 0;
+}
+
+// Return 1 if the group was created by __init__, otherwise set a python exception and return 0
+static int check_group(PWMGroupObject *self)
+{
+    if (self->group == 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "group not initialised");
+        return 0;
+    }
+    return 1;
+}
+
+// python method PWMGroup.start(self, dutycycle)
+static PyObject *PWMGroup_start(PWMGroupObject *self, PyObject *args)
+{
+    PyObject *dutycycles;
+
+    if (!PyArg_ParseTuple(args, "O", &dutycycles))
+        return NULL;
+
+    if (!check_group(self))
+        return NULL;
+
+    if (PWMGroup_set_duty_cycles(self, dutycycles) != 0)
+        return NULL;
+    pwm_group_start(self->group - 1);
+    Py_RETURN_NONE;
+}
+
+// python method PWMGroup.ChangeDutyCycle(self, dutycycle)
+static PyObject *PWMGroup_ChangeDutyCycle(PWMGroupObject *self, PyObject *args)
+{
+    PyObject *dutycycles;
+
+    if (!PyArg_ParseTuple(args, "O", &dutycycles))
+        return NULL;
+
+    if (!check_group(self))
+        return NULL;
+
+    if (PWMGroup_set_duty_cycles(self, dutycycles) != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+// python method PWMGroup.ChangeFrequency(self, frequency)
+static PyObject *PWMGroup_ChangeFrequency(PWMGroupObject *self, PyObject *args)
+{
+    float frequency;
+
+    if (!PyArg_ParseTuple(args, "f", &frequency))
+        return NULL;
+
+    if (!check_group(self))
+        return NULL;
+
+    if (frequency <= 0.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "frequency must be greater than 0.0");
+        return NULL;
+    }
+
+    self->freq = frequency;
+    pwm_group_set_frequency(self->group - 1, self->freq);
+    Py_RETURN_NONE;
+}
+
+// python method PWMGroup.stop(self)
+static PyObject *PWMGroup_stop(PWMGroupObject *self, PyObject *args)
+{
+    if (!check_group(self))
+        return NULL;
+
+    pwm_group_stop(self->group - 1);
+    Py_RETURN_NONE;
+}
+
+// deallocation method
+static void PWMGroup_dealloc(PWMGroupObject *self)
+{
+    if (self->group)
+        pwm_group_free(self->group - 1);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyMethodDef
+PWMGroup_methods[] = {
+   { "start", (PyCFunction)PWMGroup_start, METH_VARARGS, "Start the channels phase aligned\ndutycycle - the duty cycle (0.0 to 100.0) of all channels, or a list of one per channel" },
+   { "ChangeDutyCycle", (PyCFunction)PWMGroup_ChangeDutyCycle, METH_VARARGS, "Change the duty cycles from the next period\ndutycycle - between 0.0 and 100.0 for all channels, or a list of one per channel" },
+   { "ChangeFrequency", (PyCFunction)PWMGroup_ChangeFrequency, METH_VARARGS, "Change the frequency of the group\nfrequency - frequency in Hz" },
+   { "stop", (PyCFunction)PWMGroup_stop, METH_VARARGS, "Stop the group" },
+   { NULL }
+};
+
+PyTypeObject PWMGroupType = {
+   PyVarObject_HEAD_INIT(NULL,0)
+   "RPi.GPIO.PWMGroup",       // tp_name
+   sizeof(PWMGroupObject),    // tp_basicsize
+   0,                         // tp_itemsize
+   (destructor)PWMGroup_dealloc, // tp_dealloc
+   0,                         // tp_print
+   0,                         // tp_getattr
+   0,                         // tp_setattr
+   0,                         // tp_compare
+   0,                         // tp_repr
+   0,                         // tp_as_number
+   0,                         // tp_as_sequence
+   0,                         // tp_as_mapping
+   0,                         // tp_hash
+   0,                         // tp_call
+   0,                         // tp_str
+   0,                         // tp_getattro
+   0,                         // tp_setattro
+   0,                         // tp_as_buffer
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, // tp_flag
+   "Software PWM channels sharing one period, switched together\nchannels - list of channels set up as outputs\nfrequency - frequency in Hz\n[phases] - start of the pulse of each channel in % of the period (default all 0.0)", // tp_doc
+   0,                         // tp_traverse
+   0,                         // tp_clear
+   0,                         // tp_richcompare
+   0,                         // tp_weaklistoffset
+   0,                         // tp_iter
+   0,                         // tp_iternext
+   PWMGroup_methods,          // tp_methods
+   0,                         // tp_members
+   0,                         // tp_getset
+   0,                         // tp_base
+   0,                         // tp_dict
+   0,                         // tp_descr_get
+   0,                         // tp_descr_set
+   0,                         // tp_dictoffset
+   (initproc)PWMGroup_init,   // tp_init
+   0,                         // tp_alloc
+   0,                         // tp_new
+};
+
+PyTypeObject *PWMGroup_init_Type(void)
+{
+   // Fill in some slots in the type, and make it ready
+   PWMGroupType.tp_new = PyType_GenericNew;
+   if (PyType_Ready(&PWMGroupType) < 0)
+      return NULL;
+
+   return &PWMGroupType;
+}
+
+// python method IRWaveform.__init__(self, pairs, level=100.0)
+static int IRWaveform_init(IRWaveformObject *self, PyObject *args, PyObject *kwds)
+{
+    unsigned int i;
+    PyObject *tab;
+    PulsePairs source;
+    Py_buffer view;
+    float level = 100.0;
+    static char *kwlist[] = {"pairs", "level", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|f", kwlist, &tab, &level))
+        return -1;
+
+    if (level < 0.0 || level > 100.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Level must have a value from 0.0 to 100.0\% of range.");
+        return -1;
+    }
+
+    if (pulsepairs_from_object(tab, &source, &view) != 0)
+        return -1;
+
+    // keep our own copy, so the waveform does not depend on the source object any more
+    free_plusepairs(&self->pulsepairs);
+    free_plusepairs(&self->measured);
+    if (init_pulsepairs(&self->pulsepairs, source.size) != 0 || init_pulsepairs(&self->measured, source.size) != 0)
+    {
+        pulsepairs_release(&source, &view);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->duration = 0;
+    for (i = 0; i < source.size; i++) {
+        if (PULSEPAIR_PULSE(&source, i) == 0) {
+            pulsepairs_release(&source, &view);
+            PyErr_SetString(PyExc_ValueError, "Pulse durations must be greater than 0 us.");
+            return -1;
+        }
+        add_pulsepair(&self->pulsepairs, PULSEPAIR_PULSE(&source, i), PULSEPAIR_PAUSE(&source, i));
+        self->duration += (unsigned long long)PULSEPAIR_PULSE(&source, i) + PULSEPAIR_PAUSE(&source, i);
+    }
+    self->measured.size = source.size;
+    pulsepairs_release(&source, &view);
+
+    self->level = level;
+    self->cached_range = 0;
+    self->cached_data = 0;
+    return 0;
+}
+
+// PWM data for the waveform level, computed once per PWM range
+static unsigned int IRWaveform_data(IRWaveformObject *self, unsigned int range)
+{
+    if (range != self->cached_range) {
+        self->cached_data = (unsigned int) ((float)range * (self->level / 100.0));
+        self->cached_range = range;
+    }
+    return self->cached_data;
+}
+
+static Py_ssize_t IRWaveform_length(IRWaveformObject *self)
+{
+    return self->pulsepairs.size;
+}
+
+// python method IRWaveform.GetPairs()
+static PyObject *IRWaveform_GetPairs(IRWaveformObject *self, PyObject *args)
+{
+    return pulsepairs_to_list(&self->pulsepairs);
+}
+
+// deallocation method
+static void IRWaveform_dealloc(IRWaveformObject *self)
+{
+    free_plusepairs(&self->pulsepairs);
+    free_plusepairs(&self->measured);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyMethodDef
+IRWaveform_methods[] = {
+   { "GetPairs", (PyCFunction)IRWaveform_GetPairs, METH_NOARGS, "Return the pulse/pause pairs of the waveform." },
+   { NULL }
+};
+
+static PyMemberDef
+IRWaveform_members[] = {
+   { "level", T_FLOAT, offsetof(IRWaveformObject, level), READONLY, "Carrier level (0.0 to 100.0\% of range)" },
+   { "duration", T_ULONGLONG, offsetof(IRWaveformObject, duration), READONLY, "Whole frame duration in us" },
+   { NULL }
+};
+
+static PySequenceMethods
+IRWaveform_as_sequence = {
+   (lenfunc)IRWaveform_length, // sq_length
+};
+
+PyTypeObject IRWaveformType = {
+   PyVarObject_HEAD_INIT(NULL,0)
+   "RPi.GPIO.IRWaveform",            // tp_name
+   sizeof(IRWaveformObject),         // tp_basicsize
+   0,                         // tp_itemsize
+   (destructor)IRWaveform_dealloc,   // tp_dealloc
+   0,                         // tp_print
+   0,                         // tp_getattr
+   0,                         // tp_setattr
+   0,                         // tp_compare
+   0,                         // tp_repr
+   0,                         // tp_as_number
+   &IRWaveform_as_sequence,   // tp_as_sequence
+   0,                         // tp_as_mapping
+   0,                         // tp_hash
+   0,                         // tp_call
+   0,                         // tp_str
+   0,                         // tp_getattro
+   0,                         // tp_setattro
+   0,                         // tp_as_buffer
+   Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, // tp_flag
+   "Precompiled IR pulse/pause waveform, built once and sent many times with PWM2835.Transmit\npairs   - list of [pulse, pause] or flat pulse/pause uint32 buffer\n[level] - carrier level (0.0 to 100.0\% of range)",    // tp_doc
+   0,                         // tp_traverse
+   0,                         // tp_clear
+   0,                         // tp_richcompare
+   0,                         // tp_weaklistoffset
+   0,                         // tp_iter
+   0,                         // tp_iternext
+   IRWaveform_methods,        // tp_methods
+   IRWaveform_members,        // tp_members
+   0,                         // tp_getset
+   0,                         // tp_base
+   0,                         // tp_dict
+   0,                         // tp_descr_get
+   0,                         // tp_descr_set
+   0,                         // tp_dictoffset
+   (initproc)IRWaveform_init, // tp_init
+   0,                         // tp_alloc
+   0,                         // tp_new
+};
+
+PyTypeObject *IRWaveform_init_Type(void)
+{
+   // Fill in some slots in the type, and make it ready
+   IRWaveformType.tp_new = PyType_GenericNew;
+   if (PyType_Ready(&IRWaveformType) < 0)
+      return NULL;
+
+   return &IRWaveformType;
+}
+
 // python method PWM.__init__(self, pwm_channel, gpio,  diviser, range)
 static int PWM2835_init(PWM2835Object *self, PyObject *args, PyObject *kwds)
 {
@@ -224,8 +756,17 @@ static int PWM2835_init(PWM2835Object *self, PyObject *args, PyObject *kwds)
         PyErr_SetString(PyExc_ValueError, "Error in parameters");
         return -1;
     }
+    if (pwm_channel > 1) {
+        PyErr_SetString(PyExc_ValueError, "pwm_channel must be 0 or 1");
+        return -1;
+    }
     
 //    divider = pow((int) (log(divider) / log(2)), 2);
+    if (self->initialised) {    // re-init, the ramp and the use of the previous channel are ours
+        pwm_ramp_stop(self->channel);
+        release_pwm(self->channel);
+        self->initialised = 0;
+    }
     self->gpio = gpio;
     self->divider = divider;
     self->range = range;
@@ -233,7 +774,8 @@ static int PWM2835_init(PWM2835Object *self, PyObject *args, PyObject *kwds)
     self->freq = 19200000 / divider / range;
 
     init_pwm(gpio, pwm_channel, divider, range);
-    printf("PWM2835 init : gpio %d, channel : %d, frequence : %f Hz, divider : %d, range : %d\n", self->gpio, self->channel, self->freq, self->divider, self->range);
+    self->initialised = 1;
+    TRACE(TRACE_PWM2835_INIT, gpio);
     return 0;
 }
 
@@ -285,26 +827,109 @@ static PyObject *PWM2835_SetLevel(PWM2835Object *self, PyObject *args)
     
     range = (unsigned int) (self->range * (level / 100.0));
 
+    pwm_ramp_stop(self->channel);
     pwm_setlevel(self->channel, range);
     Py_RETURN_NONE;
 }
 
+// python method PWM2835.Ramp(from, to, duration_ms, curve)
+static PyObject *PWM2835_Ramp(PWM2835Object *self, PyObject *args)
+{
+    float from, to;
+    unsigned int duration_ms;
+    int curve = RAMP_LINEAR;
+    float *table = NULL;
+    Py_ssize_t i, table_size = 0;
+    PyObject *curveobj = NULL, *seq;
+    int result;
+
+    if (!PyArg_ParseTuple(args, "ffI|O", &from, &to, &duration_ms, &curveobj))
+        return NULL;
+
+    if (from < 0.0 || from > 100.0 || to < 0.0 || to > 100.0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Level must have a value from 0.0 to 100.0\% of range.");
+        return NULL;
+    }
+    if (duration_ms > RAMP_MAX_MS)
+    {
+        PyErr_SetString(PyExc_ValueError, "duration_ms is too long");
+        return NULL;
+    }
+
+    // tables first : a numpy array also passes PyNumber_Check
+    if (curveobj != NULL && PySequence_Check(curveobj))
+    {
+        if ((seq = PySequence_Fast(curveobj, "curve must be RAMP_LINEAR, RAMP_EXPONENTIAL, RAMP_GAMMA or a table")) == NULL)
+            return NULL;
+        table_size = PySequence_Fast_GET_SIZE(seq);
+        if (table_size == 0 || (table = malloc(table_size * sizeof(float))) == NULL)
+        {
+            Py_DECREF(seq);
+            if (table_size == 0)
+                PyErr_SetString(PyExc_ValueError, "curve table is empty");
+            else
+                PyErr_NoMemory();
+            return NULL;
+        }
+        for (i = 0; i < table_size; i++)
+            table[i] = (float)PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+        Py_DECREF(seq);
+        if (PyErr_Occurred())
+        {
+            free(table);
+            return NULL;
+        }
+        curve = RAMP_TABLE;
+    } else if (curveobj != NULL) {
+        curve = (int)PyLong_AsLong(curveobj);
+        if (PyErr_Occurred())
+            return NULL;
+        if (curve != RAMP_LINEAR && curve != RAMP_EXPONENTIAL && curve != RAMP_GAMMA)
+        {
+            PyErr_SetString(PyExc_ValueError, "curve must be RAMP_LINEAR, RAMP_EXPONENTIAL, RAMP_GAMMA or a table");
+            return NULL;
+        }
+    }
+
+    result = pwm_ramp_start(self->channel, self->range, from, to, duration_ms, curve, table, (unsigned int)table_size);
+    free(table);
+    if (result == RAMP_NO_MEMORY)
+        return PyErr_NoMemory();
+    if (result != RAMP_OK)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the ramp");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// python method PWM2835.StopRamp()
+static PyObject *PWM2835_StopRamp(PWM2835Object *self, PyObject *args)
+{
+    pwm_ramp_stop(self->channel);
+    Py_RETURN_NONE;
+}
+
+// python method PWM2835.IsRamping()
+static PyObject *PWM2835_IsRamping(PWM2835Object *self, PyObject *args)
+{
+    return PyBool_FromLong(pwm_ramp_running(self->channel));
+}
+
 // python method PWM.sendPulsePairs(self, PulsePairsTab, Level)
+// PulsePairsTab is a list of [pulse, pause] or a flat interleaved pulse/pause uint32 buffer read in place.
 static PyObject *PWM2835_sendPulsePairs(PWM2835Object *self, PyObject *args)
 {
-    int i, size, pairsize;
     float level = 100.0;
     unsigned int range = level;
-    int ** pulsepairs;
-    PulsePair pair;
-
+    PulsePairs pulsepairs, measured;
+    Py_buffer view;
+    long drift;
     PyObject *tab;
-    PyObject *item;
-    long pulse, pause;
+    PyObject *result;
     
-    printf("****** sendPulsePairs ******\n");
-    if (!PyArg_ParseTuple(args, "O!f", &PyList_Type, &tab, &level)) {
-        printf("--- error parsed tuple");
+    if (!PyArg_ParseTuple(args, "Of", &tab, &level)) {
         PyErr_SetString(PyExc_ValueError,  " +++ error parsetuple");
         return NULL;
     }
@@ -316,65 +941,44 @@ static PyObject *PWM2835_sendPulsePairs(PWM2835Object *self, PyObject *args)
 
     range = (unsigned int) ((float)self->range * (level / 100.0));
     
-    if (!PyList_Check(tab)) {
-        printf("--- Not a list\n");
-        if (!PyDict_Check(tab)) printf("--- Not a Dict\n");
-        return NULL;
-    }
-    size = PyList_Size(tab);
-    printf("List pulse pair size : %d, range : %i on gpio : %d, channel : %d\n", size, range, self->gpio,self->channel);
-    if (size < 0) { /* Not a list */
-        PyErr_SetString(PyExc_ValueError, "Empty pulse / pairs table");
-        return NULL; 
-    }
-    pulsepairs = malloc(sizeof(int *) * size);
-    pairsize = sizeof(pulsepairs);
-    for (i = 0; i < size; i++) {
-        item = PyList_GetItem(tab, i); /* Can't fail */
-        pairsize = PyList_Size(item);
-        if (!PyList_Check(item)) { /* Skip list object */
-            PyErr_SetString(PyExc_ValueError, "Not a list pulse pair format.");
-            return NULL;
-        }
-        if (pairsize != 2) {
-            PyErr_SetString(PyExc_ValueError, "Not a pulse pair format.");
-            return NULL;
-        }
-        pulse = PyInt_AsLong(PyList_GetItem(item, 0));
-        pause = PyInt_AsLong(PyList_GetItem(item, 1));
-        pulsepairs[i] = malloc(sizeof(long *) * 2);
-        pulsepairs[i][0] = pulse;
-        pulsepairs[i][1] = pause;
-    }
-    printf("data formaté\n");
-    pwm_setlevel(self->channel, range);
-    for (i = 0; i < size; i++) {
-        pwm_pulsepause(self->channel, pulsepairs[i][0], pulsepairs[i][1], (int)range, &pair);
- //       printf("code %d : pulse %ld us (%ld), pause %ld us (%ld)\n", i, pair.pulse, pulsepairs[i][0], pair.pause,  pulsepairs[i][1]);
-        pulsepairs[i][0] = pair.pulse;
-        pulsepairs[i][1] = pair.pause;
+    if (pulsepairs_from_object(tab, &pulsepairs, &view) != 0)
+        return NULL;
+    if (pulsepairs_measure_buffer(&pulsepairs, &measured) != 0) {
+        pulsepairs_release(&pulsepairs, &view);
+        return NULL;
     }
+    pwm_ramp_stop(self->channel);
+    drift = pwm_sendpulsepairs(self->channel, &pulsepairs, range, &measured);
     
-    PyObject *Result=PyList_New(size);
-    PyObject *ItemR=PyList_New(2);
-    
-    for (i = 0; i < size; i++) {
-        PyList_SetItem(ItemR, 0, PyInt_FromLong(pulsepairs[i][0]));
-        PyList_SetItem(ItemR, 1, PyInt_FromLong(pulsepairs[i][1]));
-        PyList_SetItem(Result, i, PyList_AsTuple(ItemR));
-    }
-    for (i = 0; i < size; i++) {
-        free(pulsepairs[i]);
-    }
+    result = pulsepairs_to_report(&measured, drift);
+    free_plusepairs(&measured);
+    pulsepairs_release(&pulsepairs, &view);
+    return result;
+}
 
-    free(pulsepairs);
-    pulsepairs = NULL;
-    return Result;
+// python method PWM2835.Transmit(self, IRWaveform)
+static PyObject *PWM2835_Transmit(PWM2835Object *self, PyObject *args)
+{
+    unsigned int data;
+    IRWaveformObject *wave;
+    long drift;
+
+    if (!PyArg_ParseTuple(args, "O!", &IRWaveformType, &wave))
+        return NULL;
+
+    data = IRWaveform_data(wave, self->range);
+    pwm_ramp_stop(self->channel);
+    drift = pwm_sendpulsepairs(self->channel, &wave->pulsepairs, data, &wave->measured);
+    return pulsepairs_to_report(&wave->measured, drift);
 }
 
 // deallocation method
 static void PWM2835_dealloc(PWM2835Object *self)
 {
+    if (self->initialised) {
+        pwm_ramp_stop(self->channel);
+        release_pwm(self->channel);
+    }
     close_bcm2835();
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -384,8 +988,12 @@ PWM2835_methods[] = {
    { "SetClock", (PyCFunction)PWM2835_SetClock, METH_VARARGS, "Set clock diviser." },
    { "SetRange", (PyCFunction)PWM2835_SetRange, METH_VARARGS, "Set range." },
    { "SetLevel", (PyCFunction)PWM2835_SetLevel, METH_VARARGS, "Set the level (0.0 to 100.0\% of range)." },
+   { "Ramp", (PyCFunction)PWM2835_Ramp, METH_VARARGS, "Ramp the level in a background thread, one data register update per ms. The level stays at the last value when the ramp ends or is stopped.\nfrom - start level (0.0 to 100.0\% of range)\nto - end level (0.0 to 100.0\% of range)\nduration_ms - length of the ramp in ms\n[curve] - RAMP_LINEAR (default), RAMP_EXPONENTIAL, RAMP_GAMMA, or a table of progress values 0.0 to 1.0 evenly spaced along the ramp" },
+   { "StopRamp", (PyCFunction)PWM2835_StopRamp, METH_VARARGS, "Stop a running ramp at its current level." },
+   { "IsRamping", (PyCFunction)PWM2835_IsRamping, METH_VARARGS, "Return True while a ramp is running." },
    { "GetFrequence", (PyCFunction)PWM2835_GetFrequence, METH_VARARGS, "Set the level (0.0 to 100.0\% of range)." },
-   { "SendPulsePairs",(PyCFunction)PWM2835_sendPulsePairs, METH_VARARGS, "Start PWM for a Pulse/Pause pairs tab - the level (0.0 to 100.0\% of range)"},
+   { "Transmit",(PyCFunction)PWM2835_Transmit, METH_VARARGS, "Send a precompiled IRWaveform.\nReturn (jitter, drift) : per pair lateness in us of the pulse and pause edges, and drift in us of the frame end."},
+   { "SendPulsePairs",(PyCFunction)PWM2835_sendPulsePairs, METH_VARARGS, "Start PWM for a Pulse/Pause pairs tab - the level (0.0 to 100.0\% of range)\nThe tab is a list of [pulse, pause] or a flat pulse/pause uint32 buffer (array('I'), numpy.uint32)\nReturn (jitter, drift) : per pair lateness in us of the pulse and pause edges, and drift in us of the frame end."},
    { NULL }
 };
 
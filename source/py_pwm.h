@@ -22,6 +22,13 @@ SOFTWARE.
 
 PyTypeObject PWMType;
 PyTypeObject *PWM_init_PWMType(void);
+PyObject *py_change_duty_cycle_bulk(PyObject *self, PyObject *args);
+
+PyTypeObject PWMGroupType;
+PyTypeObject *PWMGroup_init_Type(void);
 
 PyTypeObject PWM2835Type;
 PyTypeObject *PWM2835_init_PWMType(void);
+
+PyTypeObject IRWaveformType;
+PyTypeObject *IRWaveform_init_Type(void);
@@ -0,0 +1,227 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+// Settings from set_realtime(), SCHED_OTHER and cpu -1 leave everything untouched
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static int rt_policy = SCHED_OTHER;
+static int rt_priority = 0;
+static int rt_cpu = -1;
+static int rt_scope = 0;
+static int memory_locked = 0;
+
+// Background threads under the REALTIME_THREADS settings, with the scheduling they started with,
+// so set_realtime() applies to running threads and turning it off puts them back
+#define RT_THREADS_MAX 16
+struct rt_thread
+{
+    pthread_t thread;
+    int policy;
+    struct sched_param param;
+    cpu_set_t cpus;
+};
+static struct rt_thread rt_threads[RT_THREADS_MAX];
+static int rt_num_threads = 0;
+
+// Switch the calling thread to policy at priority and pin it to cpu, saving what it was.
+// SCHED_OTHER keeps the policy and cpu -1 the affinity. Return REALTIME_NOT_ALLOWED, with
+// nothing changed, when the thread may not be switched.
+int realtime_enter(int policy, int priority, int cpu, RtSaved *saved)
+{
+    pthread_t self = pthread_self();
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    saved->sched_changed = 0;
+    saved->cpu_changed = 0;
+    if (policy != SCHED_OTHER)
+    {
+        pthread_getschedparam(self, &saved->policy, &saved->param);
+        param.sched_priority = priority;
+        if (pthread_setschedparam(self, policy, &param) != 0)
+            return REALTIME_NOT_ALLOWED;
+        saved->sched_changed = 1;
+    }
+    if (cpu >= 0)
+    {
+        pthread_getaffinity_np(self, sizeof(saved->cpus), &saved->cpus);
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(self, sizeof(cpus), &cpus) != 0)
+        {
+            realtime_leave(saved);
+            return REALTIME_NOT_ALLOWED;
+        }
+        saved->cpu_changed = 1;
+    }
+    return REALTIME_OK;
+}
+
+void realtime_leave(RtSaved *saved)
+{
+    pthread_t self = pthread_self();
+
+    if (saved->cpu_changed)
+        pthread_setaffinity_np(self, sizeof(saved->cpus), &saved->cpus);
+    if (saved->sched_changed)
+        pthread_setschedparam(self, saved->policy, &saved->param);
+    saved->sched_changed = 0;
+    saved->cpu_changed = 0;
+}
+
+// Apply the set_realtime() settings to the calling thread for a blocking call when they cover
+// calls, realtime_leave() restores it. Failing to switch just runs the call as it was.
+void realtime_call_enter(RtSaved *saved)
+{
+    int policy, priority, cpu;
+
+    pthread_mutex_lock(&config_lock);
+    if (rt_scope & REALTIME_CALLS)
+    {
+        policy = rt_policy;
+        priority = rt_priority;
+        cpu = rt_cpu;
+    } else {
+        policy = SCHED_OTHER;
+        priority = 0;
+        cpu = -1;
+    }
+    pthread_mutex_unlock(&config_lock);
+
+    realtime_enter(policy, priority, cpu, saved);
+}
+
+// Switch a background thread to policy at priority on cpu, SCHED_OTHER and cpu -1 put back
+// what it started with. Called with config_lock held.
+static void thread_apply(struct rt_thread *t, int policy, int priority, int cpu)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    if (policy != SCHED_OTHER)
+    {
+        param.sched_priority = priority;
+        pthread_setschedparam(t->thread, policy, &param);
+    } else {
+        pthread_setschedparam(t->thread, t->policy, &t->param);
+    }
+    if (cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(t->thread, sizeof(cpus), &cpus);
+    } else {
+        pthread_setaffinity_np(t->thread, sizeof(t->cpus), &t->cpus);
+    }
+}
+
+// Register a background thread as it starts and apply the set_realtime() settings to it.
+// It must call realtime_thread_leave() before it exits.
+void realtime_thread_enter(void)
+{
+    struct rt_thread untracked;
+    struct rt_thread *t = &untracked;
+
+    pthread_mutex_lock(&config_lock);
+    if (rt_num_threads < RT_THREADS_MAX)    // else it only gets the settings of its start
+        t = &rt_threads[rt_num_threads++];
+    t->thread = pthread_self();
+    pthread_getschedparam(t->thread, &t->policy, &t->param);
+    pthread_getaffinity_np(t->thread, sizeof(t->cpus), &t->cpus);
+    if (rt_scope & REALTIME_THREADS)
+        thread_apply(t, rt_policy, rt_priority, rt_cpu);
+    pthread_mutex_unlock(&config_lock);
+}
+
+// Unregister the calling background thread, so set_realtime() no longer touches its handle
+void realtime_thread_leave(void)
+{
+    pthread_t self = pthread_self();
+    int i;
+
+    pthread_mutex_lock(&config_lock);
+    for (i = 0; i < rt_num_threads; i++)
+    {
+        if (pthread_equal(rt_threads[i].thread, self))
+        {
+            rt_threads[i] = rt_threads[--rt_num_threads];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&config_lock);
+}
+
+// Set the scheduling of the timing critical threads and calls selected by scope. SCHED_OTHER
+// with cpu -1 turns it off. lock_memory locks all pages of the process with mlockall() so no
+// page fault stalls a timed loop, it is unlocked again when turned off.
+// The settings are tried on the calling thread first and rejected if not permitted, then applied
+// to the background threads already running, or taken back from them when their scope is dropped.
+int set_realtime(int policy, int priority, int cpu, int lock_memory, int scope)
+{
+    RtSaved saved;
+    int i;
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+        return REALTIME_INVALID;
+    if (policy == SCHED_OTHER ? priority != 0 :
+        (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)))
+        return REALTIME_INVALID;
+    if (cpu < -1 || (ncpu > 0 && cpu >= ncpu))
+        return REALTIME_INVALID;
+
+    if (realtime_enter(policy, priority, cpu, &saved) != REALTIME_OK)
+        return REALTIME_NOT_ALLOWED;
+    realtime_leave(&saved);
+
+    if (lock_memory && !memory_locked)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+            return REALTIME_LOCK_FAIL;
+        memory_locked = 1;
+    } else if (!lock_memory && memory_locked) {
+        munlockall();
+        memory_locked = 0;
+    }
+
+    pthread_mutex_lock(&config_lock);
+    rt_policy = policy;
+    rt_priority = priority;
+    rt_cpu = cpu;
+    rt_scope = scope;
+    for (i = 0; i < rt_num_threads; i++)
+    {
+        if (scope & REALTIME_THREADS)
+            thread_apply(&rt_threads[i], policy, priority, cpu);
+        else
+            thread_apply(&rt_threads[i], SCHED_OTHER, 0, -1);
+    }
+    pthread_mutex_unlock(&config_lock);
+    return REALTIME_OK;
+}
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Real-time scheduling, CPU pinning and memory locking of the timing critical threads and calls */
+
+#include <sched.h>
+
+// Scheduling state of a thread saved by realtime_enter() and put back by realtime_leave()
+typedef struct RtSaved RtSaved;
+struct RtSaved
+{
+    int policy;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int sched_changed;
+    int cpu_changed;
+};
+
+int set_realtime(int policy, int priority, int cpu, int lock_memory, int scope);
+int realtime_enter(int policy, int priority, int cpu, RtSaved *saved);
+void realtime_leave(RtSaved *saved);
+void realtime_call_enter(RtSaved *saved);
+void realtime_thread_enter(void);
+void realtime_thread_leave(void);
+
+#define REALTIME_THREADS 1   // background threads (event poll, register poll, software PWM, ramps), running or started afterwards
+#define REALTIME_CALLS   2   // blocking timing calls (pulse/pause send and watch, waveforms) for their duration
+
+#define REALTIME_OK          0
+#define REALTIME_INVALID     1
+#define REALTIME_NOT_ALLOWED 2
+#define REALTIME_LOCK_FAIL   3
@@ -21,198 +21,857 @@ SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <time.h>
+#include <errno.h>
 #include "c_gpio.h"
 #include "soft_pwm.h"
-#include <stdio.h>
-
-pthread_t threads;
-
+#include "realtime.h"
+#include "trace.h"
+
+// All software PWM channels are run by a single scheduler thread. Every channel or group running
+// or waiting for its last edge sits in a min-heap keyed on the time of its next edge. The thread
+// sleeps until the earliest one and applies every edge then due with one multi-gpio write.
+// A group shares one period between its channels, each at its own phase offset, and works
+// through a sorted list of the period edges with the masks of coincident ones combined.
+
+#define PWM_EDGE_ON  0
+#define PWM_EDGE_OFF 1
+#define PWM_MERGE_NS 2000   // edges due within this of each other are written together
+#define PWM_SLEEP_NS 1000000    // waits longer than this sleep on pwm_changed, waking on changes
+#define PWM_SPIN_NS  20000  // clock_nanosleep() overshoot, busy-waited instead
+
+// The setters never take pwm_lock : they publish the next period and on times under the seq
+// seqlock and the scheduler takes them at a period start, see load_params().
 struct pwm
 {
     unsigned int gpio;
-    float freq;
+    float freq;                 // setters only
     float dutycycle;
-    float basetime;
-    float slicetime;
-    struct timespec req_on, req_off;
+    unsigned int resolution;    // duty cycle steps as a power of 2
+    unsigned int seq;           // odd while a setter publishes
+    uint64_t next_period_ns;
+    uint64_t next_on_ns;
+    uint64_t period_ns;         // in use by the scheduler for the current period
+    uint64_t on_ns;
+    uint64_t period_start;  // CLOCK_MONOTONIC ns of the current period
+    uint64_t deadline;      // next edge
+    int edge;               // PWM_EDGE_ON or PWM_EDGE_OFF
+    int running;
+    int scheduled;          // in the heap, possibly until its stop is applied
+    int group;              // group index + 1 when the gpio belongs to a group, else 0
+};
+
+struct pwm_edge
+{
+    uint64_t at;            // ns from the period start
+    uint64_t set;
+    uint64_t clr;
+};
+
+struct pwm_group
+{
+    unsigned int size;
+    unsigned int gpios[54];
+    float phase[54];        // % of the period
+    float dutycycle[54];    // setters only
+    float freq;
+    unsigned int resolution;
+    unsigned int seq;       // odd while a setter publishes
+    uint64_t next_period_ns;
+    uint64_t next_on_ns[54];
+    uint64_t period_ns;     // in use by the scheduler for the current period
+    uint64_t on_ns[54];
+    uint64_t mask;          // all member gpios
+    struct pwm_edge edges[2*54];
+    unsigned int num_edges;
+    unsigned int next_edge;
+    uint64_t period_start;
+    uint64_t deadline;
+    int allocated;
     int running;
-    struct pwm *next;
+    int scheduled;
 };
-struct pwm *pwm_list = NULL;
 
-void remove_pwm(unsigned int gpio)
+// Heap slots : 0 to 53 are the gpios of pwm_table, then the groups
+#define GROUP_SLOT(g) (54 + (g))
+
+static struct pwm pwm_table[54];
+static struct pwm_group group_table[PWM_MAX_GROUPS];
+static unsigned int heap[54 + PWM_MAX_GROUPS];  // slots ordered on their deadline
+static unsigned int heap_size = 0;
+static int thread_running = 0;
+static pthread_t scheduler_thread;
+static pthread_mutex_t pwm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwm_changed;
+static pthread_once_t pwm_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Seqlock of the published parameters. Setters serialize on an odd seq, the scheduler never
+// waits : when it finds a setter publishing it keeps the current values for one more period.
+static void params_write_begin(unsigned int *seq)
+{
+    unsigned int start;
+
+    do {
+        start = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    } while ((start & 1) || !__atomic_compare_exchange_n(seq, &start, start + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+}
+
+static void params_write_end(unsigned int *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+// Return 1 if the values read since seq was start are consistent
+static int params_read_valid(unsigned int *seq, unsigned int start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(start & 1) && __atomic_load_n(seq, __ATOMIC_RELAXED) == start;
+}
+
+// Period and on time in integer ns, the duty cycle quantized to 2^resolution steps
+static uint64_t on_time(uint64_t period_ns, float dutycycle, unsigned int resolution)
+{
+    uint64_t steps = 1ULL << resolution;
+
+    return period_ns * (uint64_t)(dutycycle * steps / 100.0 + 0.5) / steps;
+}
+
+// Publish the times of p, called between params_write_begin() and params_write_end()
+static void calculate_times(struct pwm *p)
 {
-    struct pwm *p = pwm_list;
-    struct pwm *prev = NULL;
-    struct pwm *temp;
+    uint64_t period_ns = (uint64_t)(1000000000.0 / p->freq + 0.5);
 
-    while (p != NULL)
+    __atomic_store_n(&p->next_period_ns, period_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->next_on_ns, on_time(period_ns, p->dutycycle, p->resolution), __ATOMIC_RELAXED);
+}
+
+// Take the published times of p for the period starting
+static void load_params(struct pwm *p)
+{
+    unsigned int start = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+    uint64_t period_ns = __atomic_load_n(&p->next_period_ns, __ATOMIC_RELAXED);
+    uint64_t on_ns = __atomic_load_n(&p->next_on_ns, __ATOMIC_RELAXED);
+
+    if (params_read_valid(&p->seq, start))
     {
-        if (p->gpio == gpio)
-        {
-            if (prev == NULL)
-                pwm_list = p->next;
-            else
-                prev->next = p->next;
-            temp = p;
-            p = p->next;
-            free(temp);
-        } else {
-            prev = p;
-            p = p->next;
-        }
+        p->period_ns = period_ns;
+        p->on_ns = on_ns;
     }
 }
 
-void calculate_times(struct pwm *p)
+static void group_calculate_times(struct pwm_group *g)
 {
-    long long usec;
+    uint64_t period_ns = (uint64_t)(1000000000.0 / g->freq + 0.5);
+    unsigned int i;
+
+    __atomic_store_n(&g->next_period_ns, period_ns, __ATOMIC_RELAXED);
+    for (i = 0; i < g->size; i++)
+        __atomic_store_n(&g->next_on_ns[i], on_time(period_ns, g->dutycycle[i], g->resolution), __ATOMIC_RELAXED);
+}
+
+static void group_load_params(struct pwm_group *g)
+{
+    unsigned int start = __atomic_load_n(&g->seq, __ATOMIC_ACQUIRE);
+    uint64_t period_ns = __atomic_load_n(&g->next_period_ns, __ATOMIC_RELAXED);
+    uint64_t on_ns[54];
+    unsigned int i;
+
+    for (i = 0; i < g->size; i++)
+        on_ns[i] = __atomic_load_n(&g->next_on_ns[i], __ATOMIC_RELAXED);
+    if (params_read_valid(&g->seq, start))
+    {
+        g->period_ns = period_ns;
+        for (i = 0; i < g->size; i++)
+            g->on_ns[i] = on_ns[i];
+    }
+}
 
-    usec = (long long)(p->dutycycle * p->slicetime * 1000.0);
-    p->req_on.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_on.tv_sec * 1000000LL;
-    p->req_on.tv_nsec = (long)usec * 1000L;
+// Sleep until deadline with clock_nanosleep() and busy-wait its last PWM_SPIN_NS
+static void wait_until(uint64_t deadline)
+{
+    struct timespec ts;
 
-    usec = (long long)((100.0-p->dutycycle) * p->slicetime * 1000.0);
-    p->req_off.tv_sec = (int)(usec / 1000000LL);
-    usec -= (long long)p->req_off.tv_sec * 1000000LL;
-    p->req_off.tv_nsec = (long)usec * 1000L;
+    if (deadline > PWM_SPIN_NS && now_ns() < deadline - PWM_SPIN_NS)
+    {
+        ts.tv_sec = (deadline - PWM_SPIN_NS) / 1000000000ULL;
+        ts.tv_nsec = (deadline - PWM_SPIN_NS) % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+    while (now_ns() < deadline)
+        ;
 }
 
-void full_sleep(struct timespec *req)
+static void init_once(void)
 {
-    struct timespec rem = {0};
+    pthread_condattr_t attr;
+    unsigned int i;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pwm_changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (i = 0; i < 54; i++)
+    {
+        pwm_table[i].gpio = i;
+        // default to 1 kHz frequency, dutycycle 0.0
+        pwm_table[i].freq = 1000.0;
+        pwm_table[i].dutycycle = 0.0;
+        pwm_table[i].resolution = PWM_DEFAULT_RESOLUTION;
+        calculate_times(&pwm_table[i]);
+        load_params(&pwm_table[i]);
+    }
+}
 
-    if (nanosleep(req,&rem) == -1)
-        full_sleep(&rem);
+static uint64_t slot_deadline(unsigned int slot)
+{
+    return slot < 54 ? pwm_table[slot].deadline : group_table[slot - 54].deadline;
 }
 
-void *pwm_thread(void *threadarg)
+static void heap_swap(unsigned int i, unsigned int j)
 {
-    struct pwm *p = (struct pwm *)threadarg;
+    unsigned int t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+}
 
-    while (p->running)
+static void heap_sift_up(unsigned int i)
+{
+    while (i > 0 && slot_deadline(heap[(i-1)/2]) > slot_deadline(heap[i]))
     {
+        heap_swap(i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
 
-        if (p->dutycycle > 0.0)
-        {
-            output_gpio(p->gpio, 1);
-            printf("\n gpio %d, High %ld ",p->gpio, (long)&p->req_on);
-            full_sleep(&p->req_on);
-        }
+static void heap_sift_down(unsigned int i)
+{
+    unsigned int child;
 
-        if (p->dutycycle < 100.0)
-        {
-            output_gpio(p->gpio, 0);
-            printf("gpio %d, Low %ld\n",p->gpio, (long)&p->req_off);
-            full_sleep(&p->req_off);
-        }
+    while ((child = 2*i + 1) < heap_size)
+    {
+        if (child + 1 < heap_size && slot_deadline(heap[child+1]) < slot_deadline(heap[child]))
+            child++;
+        if (slot_deadline(heap[i]) <= slot_deadline(heap[child]))
+            break;
+        heap_swap(i, child);
+        i = child;
     }
+}
 
-    // clean up
-    output_gpio(p->gpio, 0);
-    remove_pwm(p->gpio);
-    pthread_exit(NULL);
+static void heap_push(unsigned int slot)
+{
+    heap[heap_size] = slot;
+    heap_sift_up(heap_size++);
 }
 
-struct pwm *add_new_pwm(unsigned int gpio)
+static unsigned int heap_pop(void)
 {
-    struct pwm *new_pwm;
+    unsigned int slot = heap[0];
 
-    new_pwm = malloc(sizeof(struct pwm));
-    new_pwm->gpio = gpio;
-    new_pwm->running = 0;
-    new_pwm->next = NULL;
-    // default to 1 kHz frequency, dutycycle 0.0
-    new_pwm->freq = 1000.0;
-    new_pwm->dutycycle = 0.0;
-    new_pwm->basetime = 1.0;    // 1 ms
-    new_pwm->slicetime = 0.01;  // 0.01 ms
-    calculate_times(new_pwm);
-    return new_pwm;
+    heap[0] = heap[--heap_size];
+    heap_sift_down(0);
+    return slot;
 }
 
-struct pwm *find_pwm(unsigned int gpio)
+// Take slot out of the heap wherever it is
+static void heap_remove(unsigned int slot)
 {
-    struct pwm *p = pwm_list;
+    unsigned int i;
 
-    if (pwm_list == NULL)
+    for (i = 0; i < heap_size && heap[i] != slot; i++)
+        ;
+    if (i == heap_size)
+        return;
+    heap[i] = heap[--heap_size];
+    if (i < heap_size)
     {
-        pwm_list = add_new_pwm(gpio);
-        return pwm_list;
+        heap_sift_up(i);
+        heap_sift_down(i);
     }
+}
 
-    while (p != NULL)
+// Apply the edge of p, adding its gpio to set or clr, and move it to its next edge
+static void apply_edge(struct pwm *p, uint64_t now, uint64_t *set, uint64_t *clr)
+{
+    if (p->edge == PWM_EDGE_ON)
     {
-        if (p->gpio == gpio)
-            return p;
-        if (p->next == NULL)
+        if (p->on_ns > 0)
+            *set |= 1ULL << p->gpio;
+        else
+            *clr |= 1ULL << p->gpio;
+        if (p->on_ns > 0 && p->on_ns < p->period_ns)
         {
-            p->next = add_new_pwm(gpio);
-            return p->next;
+            p->edge = PWM_EDGE_OFF;
+            p->deadline = p->period_start + p->on_ns;
+            return;
         }
-        p = p->next;
+    } else {
+        *clr |= 1ULL << p->gpio;
     }
-    return NULL;
+    p->edge = PWM_EDGE_ON;
+    p->period_start += p->period_ns;
+    load_params(p);     // changes switch at the period boundary only
+    if (p->period_start + p->period_ns < now)  // more than a period behind, skip the missed ones
+        p->period_start = now;
+    p->deadline = p->period_start;
 }
 
-void pwm_set_duty_cycle(unsigned int gpio, float dutycycle)
+// Sorted edge list of the period starting, on the times published for the group, edges at the
+// same time merged in one entry
+static void group_edges(struct pwm_group *g)
 {
-    struct pwm *p;
+    uint64_t on_ns, on_at, off_at;
+    struct pwm_edge edge;
+    unsigned int i, j, n = 0;
 
-    if (dutycycle < 0.0 || dutycycle > 100.0)
+    group_load_params(g);
+    for (i = 0; i < g->size; i++)
     {
-        // btc fixme - error
-        return;
+        on_ns = g->on_ns[i];
+        on_at = (uint64_t)(g->period_ns * g->phase[i] / 100.0) % g->period_ns;
+        off_at = (on_at + on_ns) % g->period_ns;
+        g->edges[n].at = on_at;
+        g->edges[n].set = on_ns > 0 ? 1ULL << g->gpios[i] : 0;
+        g->edges[n++].clr = on_ns > 0 ? 0 : 1ULL << g->gpios[i];
+        if (on_ns > 0 && on_ns < g->period_ns)
+        {
+            g->edges[n].at = off_at;
+            g->edges[n].set = 0;
+            g->edges[n++].clr = 1ULL << g->gpios[i];
+        }
     }
 
-    if ((p = find_pwm(gpio)) != NULL)
+    // insertion sort, then merge equal times
+    for (i = 1; i < n; i++)
     {
-        p->dutycycle = dutycycle;
-        calculate_times(p);
+        edge = g->edges[i];
+        for (j = i; j > 0 && g->edges[j-1].at > edge.at; j--)
+            g->edges[j] = g->edges[j-1];
+        g->edges[j] = edge;
     }
+    for (i = 0, j = 0; i < n; i++)
+    {
+        if (j > 0 && g->edges[j-1].at == g->edges[i].at)
+        {
+            g->edges[j-1].set |= g->edges[i].set;
+            g->edges[j-1].clr |= g->edges[i].clr;
+        } else {
+            g->edges[j++] = g->edges[i];
+        }
+    }
+    g->num_edges = j;
+    g->next_edge = 0;
 }
 
-void pwm_set_frequency(unsigned int gpio, float freq)
+// Apply the next edge of group g and move it to the one after, starting a new period after the last
+static void apply_group_edge(struct pwm_group *g, uint64_t now, uint64_t *set, uint64_t *clr)
+{
+    *set |= g->edges[g->next_edge].set;
+    *clr |= g->edges[g->next_edge].clr;
+    if (++g->next_edge >= g->num_edges)
+    {
+        g->period_start += g->period_ns;
+        if (g->period_start + g->period_ns < now)  // more than a period behind, skip the missed ones
+            g->period_start = now;
+        group_edges(g);
+    }
+    g->deadline = g->period_start + g->edges[g->next_edge].at;
+}
+
+static void *pwm_thread(void *threadarg)
 {
     struct pwm *p;
+    struct pwm_group *g;
+    unsigned int slot;
+    struct timespec ts;
+    uint64_t now, deadline, set, clr;
+
+    realtime_thread_enter();
+    pthread_mutex_lock(&pwm_lock);
+    while (heap_size > 0)
+    {
+        now = now_ns();
+        deadline = slot_deadline(heap[0]);
+        if (deadline > now + PWM_SLEEP_NS)
+        {
+            ts.tv_sec = (deadline - PWM_SLEEP_NS) / 1000000000ULL;
+            ts.tv_nsec = (deadline - PWM_SLEEP_NS) % 1000000000ULL;
+            pthread_cond_timedwait(&pwm_changed, &pwm_lock, &ts);
+            continue;   // the heap may have changed
+        }
+        if (deadline > now)
+        {
+            // close enough not to miss a change for long : wait out of the lock on the clock
+            pthread_mutex_unlock(&pwm_lock);
+            wait_until(deadline);
+            pthread_mutex_lock(&pwm_lock);
+            now = now_ns();
+        }
+
+        // every edge due now, coincident ones included, in a single write
+        set = clr = 0;
+        while (heap_size > 0 && slot_deadline(heap[0]) <= now + PWM_MERGE_NS)
+        {
+            slot = heap_pop();
+            if (slot >= 54)
+            {
+                g = &group_table[slot - 54];
+                if (!g->running)
+                {
+                    clr |= g->mask;
+                    g->scheduled = 0;
+                    continue;
+                }
+                apply_group_edge(g, now, &set, &clr);
+                heap_push(slot);
+                continue;
+            }
+            p = &pwm_table[slot];
+            if (!p->running)
+            {
+                clr |= 1ULL << p->gpio;
+                p->scheduled = 0;
+                continue;
+            }
+            apply_edge(p, now, &set, &clr);
+            heap_push(slot);
+        }
+        output_gpio_mask(set, clr & ~set);
+        TRACE(TRACE_SOFT_PWM_EDGES, set);
+        TRACE(TRACE_SOFT_PWM_CLEAR, clr & ~set);
+    }
+    thread_running = 0;
+    pthread_mutex_unlock(&pwm_lock);
+    realtime_thread_leave();
+    return NULL;
+}
 
-    if (freq <= 0.0) // to avoid divide by zero
+// Start the scheduler thread if needed and wake it for a new heap entry, pwm_lock held.
+// Return -1 if the thread could not be created.
+static int start_scheduler(void)
+{
+    if (!thread_running)
+    {
+        if (pthread_create(&scheduler_thread, NULL, pwm_thread, NULL) != 0)
+            return -1;
+        pthread_detach(scheduler_thread);
+        thread_running = 1;
+    }
+    pthread_cond_signal(&pwm_changed);
+    return 0;
+}
+
+void pwm_set_duty_cycle(unsigned int gpio, float dutycycle)
+{
+    if (dutycycle < 0.0 || dutycycle > 100.0 || gpio >= 54)
     {
         // btc fixme - error
         return;
     }
 
-    if ((p = find_pwm(gpio)) != NULL)
+    pthread_once(&pwm_once, init_once);
+    params_write_begin(&pwm_table[gpio].seq);
+    pwm_table[gpio].dutycycle = dutycycle;
+    calculate_times(&pwm_table[gpio]);
+    params_write_end(&pwm_table[gpio].seq);
+}
+
+void pwm_set_frequency(unsigned int gpio, float freq)
+{
+    if (freq <= 0.0 || gpio >= 54) // to avoid divide by zero
     {
-        p->basetime = 1000.0 / freq;    // calculated in ms
-        p->slicetime = p->basetime / 100.0;
-        calculate_times(p);
+        // btc fixme - error
+        return;
     }
+
+    pthread_once(&pwm_once, init_once);
+    params_write_begin(&pwm_table[gpio].seq);
+    pwm_table[gpio].freq = freq;
+    calculate_times(&pwm_table[gpio]);
+    params_write_end(&pwm_table[gpio].seq);
+}
+
+// Set the duty cycle resolution to 2^bits steps per period, bits from 1 to PWM_MAX_RESOLUTION.
+// Return -1 if bits is out of range.
+int pwm_set_resolution(unsigned int gpio, unsigned int bits)
+{
+    if (bits < 1 || bits > PWM_MAX_RESOLUTION || gpio >= 54)
+        return -1;
+
+    pthread_once(&pwm_once, init_once);
+    params_write_begin(&pwm_table[gpio].seq);
+    pwm_table[gpio].resolution = bits;
+    calculate_times(&pwm_table[gpio]);
+    params_write_end(&pwm_table[gpio].seq);
+    return 0;
+}
+
+// Set the duty cycles of size gpios in one call, each from its next period.
+// Return -1, changing none, if a gpio or duty cycle is out of range.
+int pwm_set_duty_cycle_bulk(unsigned int *gpios, float *dutycycle, unsigned int size)
+{
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
+        if (gpios[i] >= 54 || dutycycle[i] < 0.0 || dutycycle[i] > 100.0)
+            return -1;
+    for (i = 0; i < size; i++)
+        pwm_set_duty_cycle(gpios[i], dutycycle[i]);
+    return 0;
 }
 
 void pwm_start(unsigned int gpio)
 {
     struct pwm *p;
 
-    if (((p = find_pwm(gpio)) == NULL) || p->running)
+    if (gpio >= 54)
         return;
 
-    p->running = 1;
-    if (pthread_create(&threads, NULL, pwm_thread, (void *)p) != 0)
+    pthread_once(&pwm_once, init_once);
+    pthread_mutex_lock(&pwm_lock);
+    p = &pwm_table[gpio];
+    if (!p->running && !p->group)
     {
-        // btc fixme - error
-        p->running = 0;
-        return;
+        p->running = 1;
+        if (!p->scheduled)  // else still in the heap waiting for its stop, just carries on
+        {
+            p->scheduled = 1;
+            p->edge = PWM_EDGE_ON;
+            p->period_start = p->deadline = now_ns();
+            load_params(p);
+            heap_push(gpio);
+        }
+        if (start_scheduler() != 0)
+        {
+            // btc fixme - error
+            p->running = 0;
+        }
     }
+    pthread_mutex_unlock(&pwm_lock);
 }
 
+// The gpio is cleared now, the channel leaves the heap at its next due edge
 void pwm_stop(unsigned int gpio)
 {
-    struct pwm *p;
+    if (gpio >= 54)
+        return;
 
-    if ((p = find_pwm(gpio)) != NULL)
-        p->running = 0;
+    pthread_once(&pwm_once, init_once);
+    pthread_mutex_lock(&pwm_lock);
+    if (pwm_table[gpio].running)
+    {
+        pwm_table[gpio].running = 0;
+        output_gpio(gpio, 0);
+    }
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+/******* phase aligned groups ********/
+// Create a group of size gpios sharing one period at freq, gpio i starting its pulse at phase[i] %
+// of the period (all 0 when phase is NULL). A gpio may be in one group only and not run alone.
+// Return the group index, -1 on invalid arguments or when all PWM_MAX_GROUPS are in use.
+int pwm_group_create(unsigned int *gpios, float *phase, unsigned int size, float freq)
+{
+    struct pwm_group *g = NULL;
+    unsigned int i;
+    int index;
+
+    if (size == 0 || size > 54 || freq <= 0.0)
+        return -1;
+    for (i = 0; i < size; i++)
+        if (gpios[i] >= 54 || (phase != NULL && (phase[i] < 0.0 || phase[i] >= 100.0)))
+            return -1;
+
+    pthread_once(&pwm_once, init_once);
+    pthread_mutex_lock(&pwm_lock);
+    for (index = 0; index < PWM_MAX_GROUPS; index++)
+    {
+        if (!group_table[index].allocated && !group_table[index].scheduled)
+        {
+            g = &group_table[index];
+            break;
+        }
+    }
+    for (i = 0; g != NULL && i < size; i++)
+        if (pwm_table[gpios[i]].group || pwm_table[gpios[i]].running || pwm_table[gpios[i]].scheduled)
+            g = NULL;
+    if (g == NULL)
+    {
+        pthread_mutex_unlock(&pwm_lock);
+        return -1;
+    }
+
+    g->size = size;
+    g->mask = 0;
+    for (i = 0; i < size; i++)
+    {
+        g->gpios[i] = gpios[i];
+        g->phase[i] = phase != NULL ? phase[i] : 0.0;
+        g->dutycycle[i] = 0.0;
+        g->mask |= 1ULL << gpios[i];
+        pwm_table[gpios[i]].group = index + 1;
+    }
+    g->freq = freq;
+    g->resolution = PWM_DEFAULT_RESOLUTION;
+    group_calculate_times(g);
+    g->running = 0;
+    g->allocated = 1;
+    pthread_mutex_unlock(&pwm_lock);
+    return index;
+}
+
+// Set the duty cycles of all members of the group at once, dutycycle[i] for member i, switched
+// together at the next period. Return -1, changing none, if a duty cycle is out of range.
+int pwm_group_set_duty_cycles(int group, float *dutycycle)
+{
+    struct pwm_group *g;
+    unsigned int i;
+
+    if (group < 0 || group >= PWM_MAX_GROUPS)
+        return -1;
+    g = &group_table[group];
+    for (i = 0; i < g->size; i++)
+        if (dutycycle[i] < 0.0 || dutycycle[i] > 100.0)
+            return -1;
+
+    params_write_begin(&g->seq);
+    for (i = 0; i < g->size; i++)
+        g->dutycycle[i] = dutycycle[i];
+    group_calculate_times(g);
+    params_write_end(&g->seq);
+    return 0;
+}
+
+void pwm_group_set_frequency(int group, float freq)
+{
+    struct pwm_group *g;
+
+    if (group < 0 || group >= PWM_MAX_GROUPS || freq <= 0.0)
+        return;
+
+    g = &group_table[group];
+    params_write_begin(&g->seq);
+    g->freq = freq;
+    group_calculate_times(g);
+    params_write_end(&g->seq);
+}
+
+void pwm_group_start(int group)
+{
+    struct pwm_group *g;
+
+    if (group < 0 || group >= PWM_MAX_GROUPS)
+        return;
+
+    pthread_mutex_lock(&pwm_lock);
+    g = &group_table[group];
+    if (g->allocated && !g->running)
+    {
+        g->running = 1;
+        if (!g->scheduled)
+        {
+            g->scheduled = 1;
+            g->period_start = now_ns();
+            group_edges(g);
+            g->deadline = g->period_start + g->edges[0].at;
+            heap_push(GROUP_SLOT(group));
+        }
+        if (start_scheduler() != 0)
+            g->running = 0;
+    }
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// All the gpios of the group are cleared now, it leaves the heap at its next due edge
+void pwm_group_stop(int group)
+{
+    if (group < 0 || group >= PWM_MAX_GROUPS)
+        return;
+
+    pthread_mutex_lock(&pwm_lock);
+    if (group_table[group].running)
+    {
+        group_table[group].running = 0;
+        output_gpio_mask(0, group_table[group].mask);
+    }
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+// Stop the group and release its gpios. The group leaves the heap now instead of at its next
+// edge, so the scheduler never finds it emptied. The scheduler only uses a group under pwm_lock,
+// so once the lock is taken here no period of the group is in progress.
+void pwm_group_free(int group)
+{
+    struct pwm_group *g;
+    unsigned int i;
+
+    if (group < 0 || group >= PWM_MAX_GROUPS)
+        return;
+
+    pthread_mutex_lock(&pwm_lock);
+    g = &group_table[group];
+    if (g->running)
+    {
+        g->running = 0;
+        output_gpio_mask(0, g->mask);
+    }
+    if (g->scheduled)
+    {
+        heap_remove(GROUP_SLOT(group));
+        g->scheduled = 0;
+        pthread_cond_signal(&pwm_changed);  // the scheduler may be sleeping until its edge
+    }
+    for (i = 0; i < g->size; i++)
+        pwm_table[g->gpios[i]].group = 0;
+    g->size = 0;
+    g->allocated = 0;
+    pthread_mutex_unlock(&pwm_lock);
+}
+
+#ifdef SOFT_PWM_TEST
+// Runs the scheduler against a simulated GPIO register page.
+// gcc soft_pwm.c c_gpio.c bcm2835.c realtime.c trace.c -lpthread -D SOFT_PWM_TEST
+// ./a.out
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+    static uint32_t page[1024];
+    uint32_t both = (1 << 4) | (1 << 17);
+    unsigned int gpios[3] = { 5, 6, 7 };
+    float phase[3] = { 0.0, 0.0, 50.0 };
+    float duty[3] = { 25.0, 25.0, 25.0 };
+    struct pwm_group *g;
+    uint64_t on_ns;
+    int group, errors = 0;
+
+    memset(page, 0, sizeof(page));
+    setup_map(page);
+
+    pwm_set_frequency(4, 1000.0);
+    pwm_set_duty_cycle(4, 50.0);
+    pwm_set_frequency(17, 1000.0);
+    pwm_set_duty_cycle(17, 25.0);
+    pwm_start(4);
+    pwm_start(17);
+    if (heap_size != 2 || !thread_running)
+        errors++, printf("FAIL : %u channels scheduled\n", heap_size);
+
+    // same frequency and phase : the rising edges are coincident and written at once
+    pthread_mutex_lock(&pwm_lock);
+    heap_size = 0;
+    pwm_table[4].edge = pwm_table[17].edge = PWM_EDGE_ON;
+    pwm_table[4].period_start = pwm_table[17].period_start = now_ns() + 1000000;
+    pwm_table[4].deadline = pwm_table[17].deadline = pwm_table[4].period_start;
+    heap_push(4);
+    heap_push(17);
+    pthread_cond_signal(&pwm_changed);
+    pthread_mutex_unlock(&pwm_lock);
+    usleep(20000);
+    if ((page[7] & both) != both)
+        errors++, printf("FAIL : GPSET0 %08X, coincident edges not merged\n", page[7]);
+
+    // on time quantized to the resolution, in integer ns
+    pwm_set_resolution(17, 2);
+    if (pwm_table[17].next_on_ns != 250000 || pwm_table[17].next_period_ns != 1000000)
+        errors++, printf("FAIL : 25%% on 2 bits gives %llu / %llu ns\n",
+                         (unsigned long long)pwm_table[17].next_on_ns, (unsigned long long)pwm_table[17].next_period_ns);
+    pwm_set_duty_cycle(17, 30.0);
+    if (pwm_table[17].next_on_ns != 250000)
+        errors++, printf("FAIL : 30%% on 2 bits gives %llu ns\n", (unsigned long long)pwm_table[17].next_on_ns);
+    if (pwm_set_resolution(17, PWM_MAX_RESOLUTION + 1) != -1)
+        errors++, printf("FAIL : resolution out of range accepted\n");
+    pwm_set_resolution(17, PWM_DEFAULT_RESOLUTION);
+
+    // a period starting while a setter publishes keeps the times of the previous period
+    pthread_mutex_lock(&pwm_lock);
+    load_params(&pwm_table[17]);
+    on_ns = pwm_table[17].on_ns;
+    params_write_begin(&pwm_table[17].seq);
+    pwm_table[17].dutycycle = 75.0;
+    calculate_times(&pwm_table[17]);
+    load_params(&pwm_table[17]);
+    if (pwm_table[17].on_ns != on_ns)
+        errors++, printf("FAIL : half published times taken, %llu ns\n", (unsigned long long)pwm_table[17].on_ns);
+    params_write_end(&pwm_table[17].seq);
+    load_params(&pwm_table[17]);
+    if (pwm_table[17].on_ns != 750000)
+        errors++, printf("FAIL : published times not taken, %llu ns\n", (unsigned long long)pwm_table[17].on_ns);
+    pthread_mutex_unlock(&pwm_lock);
+
+    // bulk update changes none when one duty cycle is out of range
+    gpios[0] = 4, gpios[1] = 17;
+    duty[0] = 10.0, duty[1] = 101.0;
+    if (pwm_set_duty_cycle_bulk(gpios, duty, 2) != -1 || pwm_table[4].dutycycle != 50.0)
+        errors++, printf("FAIL : bulk update out of range applied\n");
+    duty[1] = 20.0;
+    if (pwm_set_duty_cycle_bulk(gpios, duty, 2) != 0 || pwm_table[4].dutycycle != 10.0 || pwm_table[17].dutycycle != 20.0)
+        errors++, printf("FAIL : bulk update not applied\n");
+    gpios[0] = 5, gpios[1] = 6;
+    duty[0] = duty[1] = 25.0;
+
+    pwm_set_duty_cycle(17, 100.0);
+    usleep(5000);
+    page[10] = 0;
+    usleep(5000);
+    if (page[10] & (1 << 17))
+        errors++, printf("FAIL : 100%% duty channel cleared\n");
+
+    pwm_stop(4);
+    if (!(page[10] & (1 << 4)))
+        errors++, printf("FAIL : GPCLR0 %08X, stopped channel not cleared\n", page[10]);
+    pwm_stop(17);
+    usleep(5000);
+    if (heap_size != 0 || thread_running)
+        errors++, printf("FAIL : scheduler still running %u channels\n", heap_size);
+
+    // group : coincident edges of aligned members merged, the shifted member on its own edges
+    group = pwm_group_create(gpios, phase, 3, 1000.0);
+    if (group < 0 || pwm_group_create(gpios, NULL, 1, 1000.0) != -1)
+        errors++, printf("FAIL : group %d created, or gpio in two groups\n", group);
+    pwm_group_set_duty_cycles(group, duty);
+    pwm_group_start(group);
+    g = &group_table[group];
+    if (g->num_edges != 4 || g->edges[0].set != ((1 << 5) | (1 << 6)) || g->edges[1].at != 250000
+        || g->edges[1].clr != ((1 << 5) | (1 << 6)) || g->edges[2].at != 500000 || g->edges[3].clr != (1 << 7))
+        errors++, printf("FAIL : group edge list of %u edges\n", g->num_edges);
+    pwm_start(5);
+    if (pwm_table[5].running)
+        errors++, printf("FAIL : group gpio started alone\n");
+    usleep(5000);
+    pwm_group_free(group);
+    if (heap_size != 0 || group_table[group].scheduled)
+        errors++, printf("FAIL : freed group still scheduled\n");
+    if (pwm_group_create(gpios, phase, 3, 1000.0) != group)
+        errors++, printf("FAIL : freed group slot not reused\n");
+    pwm_group_free(group);
+    usleep(5000);
+    if (heap_size != 0 || thread_running)
+        errors++, printf("FAIL : group still scheduled\n");
+
+    // restart after the thread exited
+    pwm_start(4);
+    usleep(5000);
+    if (!thread_running)
+        errors++, printf("FAIL : scheduler not restarted\n");
+    pwm_stop(4);
+
+    printf("%s : %d error(s)\n", errors ? "FAIL" : "OK", errors);
+    return errors ? 1 : 0;
 }
+#endif
@@ -20,9 +20,21 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-/* Software PWM using threads */
+/* Software PWM, all channels run by one scheduler thread */
  
 void pwm_set_duty_cycle(unsigned int gpio, float dutycycle);
 void pwm_set_frequency(unsigned int gpio, float freq);
+int pwm_set_resolution(unsigned int gpio, unsigned int bits);
+int pwm_set_duty_cycle_bulk(unsigned int *gpios, float *dutycycle, unsigned int size);
 void pwm_start(unsigned int gpio);
 void pwm_stop(unsigned int gpio);
+int pwm_group_create(unsigned int *gpios, float *phase, unsigned int size, float freq);
+int pwm_group_set_duty_cycles(int group, float *dutycycle);
+void pwm_group_set_frequency(int group, float freq);
+void pwm_group_start(int group);
+void pwm_group_stop(int group);
+void pwm_group_free(int group);
+
+#define PWM_DEFAULT_RESOLUTION 10  // 1024 duty cycle steps
+#define PWM_MAX_RESOLUTION     16
+#define PWM_MAX_GROUPS         8
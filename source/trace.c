@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Multiple producer ring : a writer reserves a slot by moving head, fills it and publishes it by
+// storing its sequence number, so trace_event() never blocks. The oldest records are overwritten
+// when the reader falls behind, read_trace() counts them as lost.
+static struct
+{
+    struct trace_record record;
+    unsigned int seq;       // index + 1 of the record in the slot, 0 while being written
+} ring[TRACE_RING_SIZE];
+int trace_enabled = 0;
+static unsigned int head = 0;
+static unsigned int tail = 0;
+
+void trace_event(uint32_t id, uint32_t arg)
+{
+    struct timespec ts;
+    unsigned int index = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    unsigned int slot = index & (TRACE_RING_SIZE - 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    __atomic_store_n(&ring[slot].seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ring[slot].record.timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    ring[slot].record.id = id;
+    ring[slot].record.arg = arg;
+    __atomic_store_n(&ring[slot].seq, index + 1, __ATOMIC_RELEASE);
+}
+
+// Turning the trace on drops what was recorded before
+void trace_enable(int enable)
+{
+    if (enable && !trace_enabled)
+        tail = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&trace_enabled, enable ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+// Copy up to max records into records, oldest first, and set *lost to the number of records
+// overwritten since the last call when lost is not NULL. Must be called from one thread at a time.
+// Return the number of records.
+unsigned int read_trace(struct trace_record *records, unsigned int max, unsigned int *lost)
+{
+    unsigned int h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    unsigned int n = 0, skipped = 0, slot;
+
+    if (h - tail > TRACE_RING_SIZE) {
+        skipped = h - tail - TRACE_RING_SIZE;
+        tail = h - TRACE_RING_SIZE;
+    }
+    while (tail != h && n < max) {
+        slot = tail & (TRACE_RING_SIZE - 1);
+        if (__atomic_load_n(&ring[slot].seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;  // still being written
+        records[n] = ring[slot].record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring[slot].seq, __ATOMIC_RELAXED) != tail + 1) {
+            skipped++;  // overwritten while copied
+        } else {
+            n++;
+        }
+        tail++;
+    }
+    if (lost != NULL)
+        *lost = skipped;
+    return n;
+}
+
+#ifdef TRACE_TEST
+// Fills the ring from several threads and checks nothing is read twice or out of order.
+// gcc trace.c -lpthread -D TRACE_TEST
+// ./a.out
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define TEST_THREADS 4
+#define TEST_EVENTS  1000
+
+static void *writer(void *arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < TEST_EVENTS; i++)
+        TRACE((uint32_t)(uintptr_t)arg, i);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static struct trace_record records[TRACE_RING_SIZE];
+    pthread_t threads[TEST_THREADS];
+    unsigned int i, n, lost, next[TEST_THREADS] = {0};
+    int errors = 0;
+
+    TRACE(1, 0);
+    if (read_trace(records, TRACE_RING_SIZE, NULL) != 0)
+        errors++, printf("FAIL : recorded while disabled\n");
+
+    trace_enable(1);
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_create(&threads[i], NULL, writer, (void *)(uintptr_t)i);
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    n = read_trace(records, TRACE_RING_SIZE, &lost);
+    if (n + lost != TEST_THREADS * TEST_EVENTS)
+        errors++, printf("FAIL : %u records and %u lost, expected %u\n", n, lost, TEST_THREADS * TEST_EVENTS);
+    for (i = 0; i < n; i++) {
+        if (records[i].id >= TEST_THREADS || records[i].arg < next[records[i].id]) {
+            errors++, printf("FAIL : record %u (%u, %u) out of order\n", i, records[i].id, records[i].arg);
+            break;
+        }
+        next[records[i].id] = records[i].arg + 1;
+    }
+
+    // overflow : only the newest TRACE_RING_SIZE records are kept
+    for (i = 0; i < TRACE_RING_SIZE + 10; i++)
+        TRACE(0, i);
+    n = read_trace(records, TRACE_RING_SIZE, &lost);
+    if (n != TRACE_RING_SIZE || lost != 10 || records[0].arg != 10)
+        errors++, printf("FAIL : overflow read %u lost %u first %u\n", n, lost, records[0].arg);
+    trace_enable(0);
+
+    printf("%s : %d error(s)\n", errors ? "FAIL" : "OK", errors);
+    return errors ? 1 : 0;
+}
+#endif
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Binary trace of timing events, off by default and drained on demand instead of printing */
+
+#include <stdint.h>
+
+struct trace_record
+{
+    uint64_t timestamp;     // CLOCK_MONOTONIC ns
+    uint32_t id;            // TRACE_* event
+    uint32_t arg;
+};
+
+extern int trace_enabled;
+
+void trace_event(uint32_t id, uint32_t arg);
+void trace_enable(int enable);
+unsigned int read_trace(struct trace_record *records, unsigned int max, unsigned int *lost);
+
+// Build with -D NO_TRACE to compile every trace point out
+#ifdef NO_TRACE
+#define TRACE(id, arg) do { } while (0)
+#else
+#define TRACE(id, arg) do { if (trace_enabled) trace_event((id), (uint32_t)(arg)); } while (0)
+#endif
+
+#define TRACE_RING_SIZE 4096    // records kept, power of 2
+
+#define TRACE_BCM2835_INIT       1   // arg 1 mapped, 0 failed
+#define TRACE_PULSEPAIRS_SEND    2   // arg number of pairs
+#define TRACE_PULSEPAIRS_SENT    3   // arg drift in us of the frame end
+#define TRACE_PULSEPAIRS_WATCH   4   // arg number of pairs received
+#define TRACE_PULSEPAIRS_FREE    5   // arg number of pairs
+#define TRACE_PWM2835_INIT       6   // arg gpio
+#define TRACE_SOFT_PWM_EDGES     7   // arg GPSET0 bits written by the soft PWM scheduler
+#define TRACE_SOFT_PWM_CLEAR     8   // arg GPCLR0 bits written in the same pass
+#define TRACE_PWM_RAMP           9   // arg PWM data written by a ramp tick
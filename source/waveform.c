@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "c_gpio.h"
+#include "waveform.h"
+#include "realtime.h"
+#include "bcm2835.h"
+
+// Play size steps. priority > 0 runs the loop under SCHED_FIFO at that priority and cpu >= 0
+// pins it to that core, both restored on return. Otherwise the set_realtime() settings apply.
+int waveform_play(WaveStep *steps, unsigned int size, int priority, int cpu, WaveStats *stats)
+{
+    unsigned int i;
+    uint64_t start, deadline, now, elapsed_ns = 0;
+    uint32_t late;
+    RtSaved saved;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!BMC2835_IsInit && !init_bcm2835())
+        return WAVEFORM_NOT_MAPPED;
+
+    if (priority > 0 || cpu >= 0)
+        realtime_enter(priority > 0 ? SCHED_FIFO : SCHED_OTHER, priority, cpu, &saved);
+    else
+        realtime_call_enter(&saved);
+
+    start = bcm2835_st_read();
+    for (i = 0; i < size; i++)
+    {
+        deadline = start + elapsed_ns / 1000;
+        now = wait_deadline(deadline);
+        bcm2835_gpio_set_multi(steps[i].set_mask);
+        bcm2835_gpio_clr_multi(steps[i].clr_mask);
+        late = (uint32_t)(now - deadline);
+        if (late)
+        {
+            stats->late_steps++;
+            stats->sum_late += late;
+            if (late > stats->max_late)
+                stats->max_late = late;
+        }
+        elapsed_ns += steps[i].delay_ns;
+    }
+    deadline = start + elapsed_ns / 1000;
+    stats->drift = (long)(wait_deadline(deadline) - deadline);
+
+    realtime_leave(&saved);
+    return WAVEFORM_OK;
+}
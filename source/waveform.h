@@ -0,0 +1,49 @@
+/*
+Copyright (c) 2014 Ben Croston
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Bit-bang engine : replays a sequence of multi-gpio steps on absolute system timer deadlines */
+
+// One step : set_mask then clr_mask are written to GPSET0/GPCLR0 at the step deadline, and the
+// next step is due delay_ns later. Deadlines are summed in ns from the start, so rounding to the
+// 1 us system timer never accumulates.
+typedef struct WaveStep WaveStep;
+struct WaveStep
+{
+    uint32_t set_mask;
+    uint32_t clr_mask;
+    uint32_t delay_ns;
+};
+
+// Lateness of the steps against their deadlines, in us
+typedef struct WaveStats WaveStats;
+struct WaveStats
+{
+    uint32_t max_late;
+    uint64_t sum_late;
+    unsigned int late_steps;    // steps written at least 1 us after their deadline
+    long drift;                 // lateness of the end of the last delay
+};
+
+int waveform_play(WaveStep *steps, unsigned int size, int priority, int cpu, WaveStats *stats);
+
+#define WAVEFORM_OK         0
+#define WAVEFORM_NOT_MAPPED 1
@@ -32,6 +32,7 @@ LOOP_OUT = 22
 import sys
 import warnings
 import time
+from array import array
 from threading import Timer
 import RPi.GPIO as GPIO
 if sys.version[:3] == '2.6':
@@ -103,6 +104,107 @@ class TestInputOutput(unittest.TestCase):
         self.assertEqual(GPIO.input(LOOP_IN), GPIO.HIGH)
         GPIO.cleanup()
 
+    def test_list(self):
+        """Test output() and input() of several channels at once"""
+        GPIO.setup(LOOP_IN, GPIO.IN, pull_up_down=GPIO.PUD_OFF)
+        GPIO.setup(LOOP_OUT, GPIO.OUT, initial=GPIO.LOW)
+        GPIO.setup(LED_PIN, GPIO.OUT, initial=GPIO.LOW)
+        GPIO.output([LOOP_OUT, LED_PIN], [GPIO.HIGH, GPIO.LOW])
+        self.assertEqual(GPIO.input((LOOP_IN, LOOP_OUT, LED_PIN)), [GPIO.HIGH, GPIO.HIGH, GPIO.LOW])
+        GPIO.output((LOOP_OUT, LED_PIN), GPIO.HIGH)
+        self.assertEqual(GPIO.input([LED_PIN]), [GPIO.HIGH])
+        with self.assertRaises(ValueError):
+            GPIO.output([LOOP_OUT, LED_PIN], [GPIO.LOW])
+        with self.assertRaises(RuntimeError):
+            GPIO.output([LOOP_OUT, LOOP_IN], GPIO.LOW)
+        GPIO.cleanup()
+
+    def test_pin(self):
+        """Test write() and read() of a Pin resolved once"""
+        GPIO.setup(LOOP_IN, GPIO.IN, pull_up_down=GPIO.PUD_OFF)
+        GPIO.setup(LOOP_OUT, GPIO.OUT, initial=GPIO.LOW)
+        pin_in = GPIO.Pin(LOOP_IN)
+        pin_out = GPIO.Pin(LOOP_OUT)
+        self.assertEqual(pin_in.read(), GPIO.LOW)
+        pin_out.write(GPIO.HIGH)
+        self.assertEqual(pin_in.read(), GPIO.HIGH)
+        self.assertEqual(GPIO.input(LOOP_IN), GPIO.HIGH)
+        with self.assertRaises(RuntimeError):
+            pin_in.write(GPIO.LOW)
+        with self.assertRaises(RuntimeError):
+            GPIO.Pin(SWITCH_PIN)
+        GPIO.cleanup()
+
+    def test_pin_value(self):
+        """Test value, toggle() and pulse() of a Pin set up at construction"""
+        pin_in = GPIO.Pin(LOOP_IN, GPIO.IN, pull_up_down=GPIO.PUD_OFF)
+        pin_out = GPIO.Pin(LOOP_OUT, GPIO.OUT, initial=GPIO.LOW)
+        self.assertEqual(pin_in.value, GPIO.LOW)
+        pin_out.value = GPIO.HIGH
+        self.assertEqual(pin_in.value, GPIO.HIGH)
+        pin_out.toggle()
+        self.assertEqual(pin_in.value, GPIO.LOW)
+        pin_out.pulse(100)
+        self.assertEqual(pin_out.value, GPIO.LOW)
+        with self.assertRaises(RuntimeError):
+            pin_in.value = GPIO.HIGH
+        with self.assertRaises(RuntimeError):
+            pin_in.toggle()
+        GPIO.cleanup(LOOP_OUT)
+        with self.assertRaises(RuntimeError):
+            pin_out.write(GPIO.HIGH)
+        with self.assertRaises(RuntimeError):
+            pin_out.toggle()
+        GPIO.cleanup()
+
+    def test_pin_uninitialised(self):
+        """Test a Pin whose __init__ did not run raises instead of using unresolved registers"""
+        class LazyPin(GPIO.Pin):
+            def __init__(self):
+                pass
+        for pin in (GPIO.Pin.__new__(GPIO.Pin), LazyPin()):
+            for method in (pin.read, pin.toggle, lambda: pin.write(1), lambda: pin.value):
+                with self.assertRaises(RuntimeError):
+                    method()
+
+    def test_waveform(self):
+        """Test BCMPlayWaveform() replays steps on their deadlines"""
+        GPIO.setup(LED_PIN, GPIO.OUT, initial=GPIO.LOW)
+        mask = 1 << LED_PIN_BCM
+        steps = [(mask, 0, 500000), (0, mask, 500000)] * 10 + [(mask, 0, 0)]
+        start = time.time()
+        max_late, mean_late, late_steps, drift = GPIO.BCMPlayWaveform(steps)
+        self.assertAlmostEqual(time.time() - start, 10.0 * 1e-3, delta=5e-3)
+        self.assertTrue(mean_late <= max_late)
+        self.assertTrue(late_steps <= len(steps))
+        self.assertTrue(drift >= 0)
+        self.assertEqual(GPIO.input(LED_PIN), GPIO.HIGH)
+        # steps as lists are taken too, bad steps are rejected before playing
+        GPIO.BCMPlayWaveform([[0, mask, 0]])
+        self.assertEqual(GPIO.input(LED_PIN), GPIO.LOW)
+        with self.assertRaises(ValueError):
+            GPIO.BCMPlayWaveform([(mask, 0)])
+        with self.assertRaises(ValueError):
+            GPIO.BCMPlayWaveform([(mask, 0, 1 << 32)])
+        with self.assertRaises(ValueError):
+            GPIO.BCMPlayWaveform([(mask, -1, 0)])
+        with self.assertRaises(TypeError):
+            GPIO.BCMPlayWaveform([mask])
+        GPIO.cleanup()
+
+    def test_realtime(self):
+        """Test set_realtime() validates and applies to timing calls"""
+        with self.assertRaises(ValueError):
+            GPIO.set_realtime(GPIO.SCHED_FIFO, 0)
+        with self.assertRaises(ValueError):
+            GPIO.set_realtime(GPIO.SCHED_OTHER, cpu=1024)
+        GPIO.set_realtime(GPIO.SCHED_FIFO, 50, cpu=0, lock_memory=True)
+        GPIO.setup(LED_PIN, GPIO.OUT, initial=GPIO.LOW)
+        mask = 1 << LED_PIN_BCM
+        GPIO.BCMPlayWaveform([(mask, 0, 1000000), (0, mask, 0)])
+        GPIO.set_realtime(GPIO.SCHED_OTHER)
+        GPIO.cleanup()
+
     def test_output_on_input(self):
         """Test output() can not be done on input"""
         GPIO.setup(SWITCH_PIN, GPIO.IN)
@@ -134,6 +236,176 @@ class TestSoftPWM(unittest.TestCase):
         self.assertEqual(response,'Y')
         GPIO.cleanup()
 
+class TestTrace(unittest.TestCase):
+    def runTest(self):
+        GPIO.setup(LED_PIN, GPIO.OUT)
+        pwm = GPIO.PWM(LED_PIN, 1000)
+        pwm.start(50)
+        time.sleep(0.01)
+        self.assertEqual(GPIO.read_trace(), [])
+        GPIO.set_trace(True)
+        time.sleep(0.02)
+        GPIO.set_trace(False)
+        pwm.stop()
+        records = GPIO.read_trace()
+        edges = [r for r in records if r[1] == GPIO.TRACE_SOFT_PWM_EDGES and r[2] & (1 << LED_PIN_BCM)]
+        self.assertTrue(15 <= len(edges) <= 25)
+        self.assertEqual(sorted(records), records)
+        GPIO.cleanup()
+
+class TestSoftPWMTiming(unittest.TestCase):
+    def runTest(self):
+        GPIO.setup(LED_PIN, GPIO.OUT)
+        pwm = GPIO.PWM(LED_PIN, 2000)
+        with self.assertRaises(ValueError):
+            pwm.ChangeResolution(17)
+        pwm.ChangeResolution(12)
+        pwm.start(25)
+        GPIO.read_trace()
+        GPIO.set_trace(True)
+        time.sleep(0.01)
+        GPIO.set_trace(False)
+        pwm.stop()
+        mask = 1 << LED_PIN_BCM
+        rising = [r[0] for r in GPIO.read_trace() if r[1] == GPIO.TRACE_SOFT_PWM_EDGES and r[2] & mask]
+        periods = [b - a for a, b in zip(rising, rising[1:])]
+        self.assertTrue(len(periods) > 10)
+        # 500 us period, edges on absolute deadlines
+        self.assertAlmostEqual(sum(periods) / float(len(periods)), 500000, delta=5000)
+        GPIO.cleanup()
+
+class TestChangeDutyCycleBulk(unittest.TestCase):
+    def runTest(self):
+        GPIO.setup(LED_PIN, GPIO.OUT)
+        GPIO.setup(LOOP_OUT, GPIO.OUT)
+        GPIO.setup(LOOP_IN, GPIO.IN, pull_up_down=GPIO.PUD_OFF)
+        pwms = [GPIO.PWM(LED_PIN, 1000), GPIO.PWM(LOOP_OUT, 1000)]
+        for pwm in pwms:
+            pwm.start(10)
+        with self.assertRaises(ValueError):
+            GPIO.ChangeDutyCycleBulk(pwms, [50, 101])
+        with self.assertRaises(ValueError):
+            GPIO.ChangeDutyCycleBulk(pwms, [50])
+        with self.assertRaises(TypeError):
+            GPIO.ChangeDutyCycleBulk([LED_PIN], 50)
+        # fade both channels with no glitch, each step taken at a period boundary
+        for duty in range(0, 101, 5):
+            GPIO.ChangeDutyCycleBulk(pwms, duty)
+            time.sleep(0.002)
+        GPIO.ChangeDutyCycleBulk(pwms, [0, 100])
+        try:
+            import numpy
+            GPIO.ChangeDutyCycleBulk(pwms, numpy.array([0.0, 100.0]))   # a sequence, not one number
+        except ImportError:
+            pass
+        time.sleep(0.005)
+        self.assertEqual(GPIO.input(LOOP_IN), GPIO.HIGH)
+        for pwm in pwms:
+            pwm.stop()
+        GPIO.cleanup()
+
+class TestPWMGroup(unittest.TestCase):
+    def runTest(self):
+        GPIO.setup(LED_PIN, GPIO.OUT)
+        GPIO.setup(LOOP_OUT, GPIO.OUT)
+        with self.assertRaises(ValueError):
+            GPIO.PWMGroup([LED_PIN, LOOP_OUT], 1000, phases=[0.0])
+        group = GPIO.PWMGroup([LED_PIN, LOOP_OUT], 1000)
+        with self.assertRaises(RuntimeError):
+            GPIO.PWMGroup([LED_PIN], 1000)
+        group.start([50, 25])
+        GPIO.read_trace()
+        GPIO.set_trace(True)
+        time.sleep(0.01)
+        GPIO.set_trace(False)
+        group.stop()
+        both = (1 << LED_PIN_BCM) | (1 << 25)   # LOOP_OUT is BCM 25
+        sets = [r[2] for r in GPIO.read_trace() if r[1] == GPIO.TRACE_SOFT_PWM_EDGES and r[2]]
+        # rising edges of the aligned channels in one write
+        self.assertTrue(len(sets) >= 8)
+        self.assertTrue(all(s & both == both for s in sets))
+        # same channels again on the same object
+        group.__init__([LED_PIN, LOOP_OUT], 500)
+        del group
+        bare = GPIO.PWMGroup.__new__(GPIO.PWMGroup)
+        for method in (bare.stop, lambda: bare.start(50), lambda: bare.ChangeDutyCycle(50), lambda: bare.ChangeFrequency(10)):
+            with self.assertRaises(RuntimeError):
+                method()
+        GPIO.cleanup()
+
+class TestPWM2835Ramp(unittest.TestCase):
+    def runTest(self):
+        pwm = GPIO.PWM2835(0, LED_PIN_BCM, 16, 1000)   # PWM0 on BCM 18
+        with self.assertRaises(ValueError):
+            pwm.Ramp(0, 101, 100)
+        with self.assertRaises(ValueError):
+            pwm.Ramp(0, 100, 100, 7)
+        GPIO.read_trace()
+        GPIO.set_trace(True)
+        pwm.Ramp(0, 100, 100, GPIO.RAMP_GAMMA)
+        self.assertTrue(pwm.IsRamping())
+        time.sleep(0.2)
+        GPIO.set_trace(False)
+        self.assertFalse(pwm.IsRamping())
+        data = [r for r in GPIO.read_trace() if r[1] == GPIO.TRACE_PWM_RAMP]
+        values = [r[2] for r in data]
+        # one update per 1 ms tick at most, slow start of the gamma curve, ends on the target
+        self.assertEqual(values[-1], 1000)
+        self.assertEqual(values, sorted(values))
+        self.assertTrue(values[len(values) // 2] < 500)
+        self.assertAlmostEqual((data[-1][0] - data[0][0]) / 1000000.0, 100, delta=6)
+        # user table, stopped mid way
+        pwm.Ramp(0, 100, 1000, [0.0, 1.0, 0.0])
+        # an object never initialised owns no channel, freeing it leaves the ramp of channel 0
+        bare = GPIO.PWM2835.__new__(GPIO.PWM2835)
+        del bare
+        self.assertTrue(pwm.IsRamping())
+        time.sleep(0.1)
+        pwm.StopRamp()
+        self.assertFalse(pwm.IsRamping())
+        pwm.SetLevel(0)
+
+class TestPulsePairsBuffer(unittest.TestCase):
+    def setUp(self):
+        self.pairs = array('I', [9000, 4500, 560, 560, 560, 1690])
+
+    def test_pwm2835(self):
+        pwm = GPIO.PWM2835(0, LED_PIN_BCM, 16, 1000)   # PWM0 on BCM 18
+        jitter, drift = pwm.SendPulsePairs(self.pairs, 50.0)
+        self.assertEqual(len(jitter), 3)
+        # the buffer is read in place, never written
+        self.assertEqual(list(self.pairs), [9000, 4500, 560, 560, 560, 1690])
+
+    def test_gpio(self):
+        jitter, drift = GPIO.BCMPulsePairsGPIO(self.pairs, LED_PIN_BCM)
+        self.assertEqual(len(jitter), 3)
+        self.assertEqual(list(self.pairs), [9000, 4500, 560, 560, 560, 1690])
+
+    def test_pwm_busy(self):
+        GPIO.setup(LED_PIN, GPIO.OUT, initial=GPIO.LOW)
+        pwm = GPIO.PWM2835(0, LED_PIN_BCM, 16, 1000)
+        with self.assertRaises(RuntimeError):
+            GPIO.BCMPulsePairsGPIO(self.pairs, LED_PIN_BCM)
+        del pwm
+        GPIO.setup(LED_PIN, GPIO.OUT, initial=GPIO.LOW)
+        GPIO.BCMPulsePairsGPIO(self.pairs, LED_PIN_BCM)
+        # the carrier gives the pin back as a plain output
+        self.assertEqual(GPIO.gpio_function(LED_PIN), GPIO.OUT)
+        GPIO.cleanup(LED_PIN)
+
+    def test_invalid(self):
+        pwm = GPIO.PWM2835(0, LED_PIN_BCM, 16, 1000)
+        for pairs in (array('H', [560, 560]),       # wrong itemsize
+                      array('f', [560.0, 560.0]),   # wrong format
+                      array('I', [560, 560, 560]),  # odd length
+                      array('I')):                  # empty
+            with self.assertRaises(ValueError):
+                pwm.SendPulsePairs(pairs, 50.0)
+            with self.assertRaises(ValueError):
+                GPIO.BCMPulsePairsGPIO(pairs, LED_PIN_BCM)
+        with self.assertRaises(OverflowError):
+            GPIO.BCMPulsePairsGPIO([[1 << 32, 560]], LED_PIN_BCM)
+
 class TestSetWarnings(unittest.TestCase):
     def test_alreadyinuse(self):
         """Test 'already in use' warning"""
@@ -239,6 +511,15 @@ class TestSwitchBounce(unittest.TestCase):
                 print 'Button press',self.switchcount
         GPIO.remove_event_detect(SWITCH_PIN)
 
+    def test_switchstable(self):
+        self.switchcount = 0
+        print "\nStable level switch bounce test.  Press switch at least 10 times and count..."
+        GPIO.add_event_detect(SWITCH_PIN, GPIO.FALLING, callback=self.cb)
+        GPIO.set_debounce(SWITCH_PIN, GPIO.DEBOUNCE_STABLE, 20000)
+        while self.switchcount < 10:
+            time.sleep(1)
+        GPIO.remove_event_detect(SWITCH_PIN)
+
     def tearDown(self):
         GPIO.cleanup()
 
@@ -293,6 +574,75 @@ class TestEdgeDetection(unittest.TestCase):
         self.assertEqual(GPIO.event_detected(LOOP_IN), True)
         GPIO.remove_event_detect(LOOP_IN)
 
+    def testReadEdges(self):
+        GPIO.output(LOOP_OUT, GPIO.LOW)
+        GPIO.add_event_detect(LOOP_IN, GPIO.BOTH)
+        time.sleep(0.001)
+        self.assertEqual(GPIO.read_edges(LOOP_IN), [])
+        for i in range(5):
+            GPIO.output(LOOP_OUT, GPIO.HIGH)
+            time.sleep(0.001)
+            GPIO.output(LOOP_OUT, GPIO.LOW)
+            time.sleep(0.001)
+        edges = GPIO.read_edges(LOOP_IN, 4)
+        edges += GPIO.read_edges(LOOP_IN)
+        self.assertEqual([level for timestamp, level in edges], [1, 0] * 5)
+        self.assertEqual(sorted(edges), edges)
+        GPIO.remove_event_detect(LOOP_IN)
+        with self.assertRaises(RuntimeError):
+            GPIO.read_edges(LOOP_IN)
+
+    def testCdevBackend(self):
+        GPIO.output(LOOP_OUT, GPIO.LOW)
+        GPIO.set_event_backend(GPIO.EVENT_CDEV)
+        GPIO.add_event_detect(LOOP_IN, GPIO.BOTH)
+        with self.assertRaises(RuntimeError):
+            GPIO.set_event_backend(GPIO.EVENT_SYSFS)
+        for i in range(3):
+            GPIO.output(LOOP_OUT, GPIO.HIGH)
+            time.sleep(0.001)
+            GPIO.output(LOOP_OUT, GPIO.LOW)
+            time.sleep(0.001)
+        self.assertEqual(GPIO.event_detected(LOOP_IN), True)
+        edges = GPIO.read_edges(LOOP_IN)
+        self.assertEqual([level for timestamp, level in edges], [1, 0] * 3)
+        GPIO.remove_event_detect(LOOP_IN)
+        GPIO.set_event_backend(GPIO.EVENT_SYSFS)
+
+    def testRegsBackend(self):
+        def cb(channel):
+            self.callback_count += 1
+
+        self.callback_count = 0
+        GPIO.output(LOOP_OUT, GPIO.LOW)
+        GPIO.set_event_backend(GPIO.EVENT_REGS)
+        GPIO.add_event_detect(LOOP_IN, GPIO.RISING, callback=cb)
+        for i in range(5):
+            GPIO.output(LOOP_OUT, GPIO.HIGH)
+            time.sleep(0.001)
+            GPIO.output(LOOP_OUT, GPIO.LOW)
+            time.sleep(0.001)
+        self.assertEqual(self.callback_count, 5)
+        GPIO.remove_event_detect(LOOP_IN)
+        GPIO.set_event_backend(GPIO.EVENT_SYSFS)
+
+    def testEventStats(self):
+        with self.assertRaises(ValueError):
+            GPIO.set_event_batch(0)
+        GPIO.set_event_batch(8)
+        GPIO.output(LOOP_OUT, GPIO.LOW)
+        GPIO.add_event_detect(LOOP_IN, GPIO.BOTH)
+        time.sleep(0.001)
+        GPIO.event_stats(reset=True)
+        GPIO.output(LOOP_OUT, GPIO.HIGH)
+        time.sleep(0.001)
+        stats = GPIO.event_stats()
+        self.assertEqual(stats['events'], 1)
+        self.assertEqual(stats['wakeups'], 1)
+        self.assertEqual(stats['max_batch'], 1)
+        GPIO.remove_event_detect(LOOP_IN)
+        GPIO.set_event_batch(16)
+
     def testWaitForRising(self):
         def makehigh():
             GPIO.output(LOOP_OUT, GPIO.HIGH)
@@ -367,6 +717,40 @@ class TestEdgeDetection(unittest.TestCase):
         self.assertEqual(self.callback_count, 10)
         GPIO.remove_event_detect(LOOP_IN)
 
+    def testBatchedCallback(self):
+        def cb(channel):
+            self.callback_count += 1
+
+        GPIO.set_callback_window(LOOP_IN, 0)     # before any dispatcher was started
+        GPIO.set_callback_dispatch(True)
+        GPIO.set_callback_dispatch(False)        # joins the dispatcher, a start gets a single one
+        GPIO.set_callback_dispatch(True)
+        self.callback_count = 0
+        GPIO.output(LOOP_OUT, GPIO.LOW)
+        GPIO.add_event_detect(LOOP_IN, GPIO.RISING, callback=cb)
+        time.sleep(0.001)
+        for i in range(5):
+            GPIO.output(LOOP_OUT, GPIO.HIGH)
+            time.sleep(0.001)
+            GPIO.output(LOOP_OUT, GPIO.LOW)
+            time.sleep(0.001)
+        time.sleep(0.01)
+        self.assertEqual(self.callback_count, 5)
+
+        # edges within the window make a single call
+        self.callback_count = 0
+        GPIO.set_callback_window(LOOP_IN, 500000)
+        for i in range(5):
+            GPIO.output(LOOP_OUT, GPIO.HIGH)
+            time.sleep(0.001)
+            GPIO.output(LOOP_OUT, GPIO.LOW)
+            time.sleep(0.001)
+        time.sleep(0.6)
+        self.assertTrue(1 <= self.callback_count <= 2)
+        GPIO.set_callback_window(LOOP_IN, 0)
+        GPIO.remove_event_detect(LOOP_IN)
+        GPIO.set_callback_dispatch(False)
+
     def testEventOnOutput(self):
         with self.assertRaises(RuntimeError):
             GPIO.add_event_detect(LOOP_OUT, GPIO.FALLING)
@@ -396,6 +780,20 @@ class TestCleanup(unittest.TestCase):
         self.assertEqual(GPIO.gpio_function(LOOP_OUT), GPIO.IN)
         self.assertEqual(GPIO.gpio_function(LED_PIN), GPIO.IN)
 
+class TestIRWaveform(unittest.TestCase):
+    def test_build(self):
+        wave = GPIO.IRWaveform([[9000, 4500], [560, 560]], level=50.0)
+        self.assertEqual(len(wave), 2)
+        self.assertEqual(wave.duration, 14620)
+        self.assertEqual(wave.level, 50.0)
+        self.assertEqual(wave.GetPairs(), [(9000, 4500), (560, 560)])
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError):
+            GPIO.IRWaveform([[0, 560]])
+        with self.assertRaises(ValueError):
+            GPIO.IRWaveform([[560, 560]], level=150.0)
+
 #def test_suite():
 #    suite = unittest.TestLoader().loadTestsFromModule()
 #    return suite